@@ -0,0 +1,66 @@
+/* Preallocated, prefaulted memory */
+#include "arena.h"
+#include <sys/mman.h>
+
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+err_t arena_init(arena_t *a, size_t size)
+{
+    _MZ(a,arena_t,1);
+    if (size == 0) {
+        return err_EINVAL;
+    }
+    size = arena_size(size);
+    void *p = mmap(NULL,size,PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,-1,0);
+    if (p == MAP_FAILED) {
+        return err_MEM;
+    }
+    a->base = p;
+    a->size = size;
+    /* locking faults in every page too, but may not be allowed, so write
+     * to them all in case MAP_POPULATE left any out */
+    a->locked = mlock(a->base,a->size) == 0;
+    if (!a->locked) {
+        memset(a->base,0,a->size);
+    }
+    return err_NONE;
+}
+
+void arena_destroy(arena_t *a)
+{
+    if (a->base) {
+        munmap(a->base,a->size);
+    }
+    _MZ(a,arena_t,1);
+}
+
+/* Returns size zeroed bytes on a cache line, or NULL if the arena hasn't
+ * that much left */
+void *arena_alloc(arena_t *a, size_t size)
+{
+    size = arena_size(size);
+    if (!a) {
+        void *p = aligned_alloc(ARENA_ALIGN,size ? size : ARENA_ALIGN);
+        if (p) {
+            memset(p,0,size);
+        }
+        return p;
+    }
+    if (size > a->size - a->used) {
+        return NULL;
+    }
+    void *p = a->base + a->used;
+    a->used += size;
+    return p;
+}
+
+/* Only heap memory is freed, an arena's goes all at once */
+void arena_free(arena_t *a, void *p)
+{
+    if (!a) {
+        _F(p);
+    }
+}
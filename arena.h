@@ -0,0 +1,35 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+
+/* One block of memory that everything the audio thread touches is carved
+ * out of when the engine starts. It is mapped, faulted in and, if the
+ * limits allow, locked up front, so no page is first touched, or swapped
+ * out, while playing. Nothing is given back until the whole arena is, so
+ * its size is worked out beforehand from each module's *_mem_size. Every
+ * piece starts on its own cache line and is zeroed.
+ * Functions taking an arena use the heap instead when it is NULL. */
+
+#define ARENA_ALIGN 64
+
+typedef struct arena_t {
+    char *base;
+    size_t size;
+    size_t used;
+    int locked; /* pages can't be swapped out */
+} arena_t;
+
+/* What a piece of size bytes takes up in an arena */
+#define arena_size(size) (((size) + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN)
+
+err_t arena_init(arena_t *a, size_t size);
+void arena_destroy(arena_t *a);
+void *arena_alloc(arena_t *a, size_t size);
+void arena_free(arena_t *a, void *p);
+
+#endif /* ARENA_H */
@@ -0,0 +1,94 @@
+/* Single-producer/single-consumer command queue */
+#include "cmdq.h"
+
+/* The size a queue asked for size is made */
+size_t cmdq_round(size_t size)
+{
+    size_t sz = 1;
+    while (sz < size) {
+        sz <<= 1;
+    }
+    return sz;
+}
+
+size_t cmdq_mem_size(size_t size)
+{
+    return arena_size(cmdq_round(size) * sizeof(cmd_t));
+}
+
+/* size is rounded up to a power of 2. Takes cmdq_mem_size(size) bytes from
+ * arena. */
+err_t cmdq_init(cmdq_t *q, size_t size, arena_t *arena)
+{
+    size_t sz = cmdq_round(size);
+    _MZ(q,cmdq_t,1);
+    q->_arena = arena;
+    q->cmds = arena_alloc(arena,sz * sizeof(cmd_t));
+    if (!q->cmds) {
+        return err_MEM;
+    }
+    q->size = sz;
+    atomic_init(&q->head,0);
+    atomic_init(&q->tail,0);
+    atomic_init(&q->n_applied,0);
+    atomic_init(&q->n_dropped,0);
+    return err_NONE;
+}
+
+void cmdq_destroy(cmdq_t *q)
+{
+    arena_free(q->_arena,q->cmds);
+    _MZ(q,cmdq_t,1);
+}
+
+/* Only called by the producer. Returns err_FULL, and counts the command as
+ * dropped, if there is no room. */
+err_t cmdq_push(cmdq_t *q, cmd_t *c)
+{
+    size_t tail = atomic_load_explicit(&q->tail,memory_order_relaxed);
+    if (tail - q->_head_cache == q->size) {
+        q->_head_cache = atomic_load_explicit(&q->head,memory_order_acquire);
+        if (tail - q->_head_cache == q->size) {
+            cmdq_dropped(q);
+            return err_FULL;
+        }
+    }
+    q->cmds[tail & (q->size - 1)] = *c;
+    atomic_store_explicit(&q->tail,tail + 1,memory_order_release);
+    return err_NONE;
+}
+
+/* Only called by the consumer. Returns 0 if the queue is empty. */
+int cmdq_pop(cmdq_t *q, cmd_t *c)
+{
+    size_t head = atomic_load_explicit(&q->head,memory_order_relaxed);
+    if (head == q->_tail_cache) {
+        q->_tail_cache = atomic_load_explicit(&q->tail,memory_order_acquire);
+        if (head == q->_tail_cache) {
+            return 0;
+        }
+    }
+    *c = q->cmds[head & (q->size - 1)];
+    atomic_store_explicit(&q->head,head + 1,memory_order_release);
+    return 1;
+}
+
+void cmdq_stats(cmdq_t *q, size_t *n_applied, size_t *n_dropped)
+{
+    *n_applied = atomic_load_explicit(&q->n_applied,memory_order_relaxed);
+    *n_dropped = atomic_load_explicit(&q->n_dropped,memory_order_relaxed);
+}
+
+/* Only called by the consumer. Returns the command cmdq_pop would give
+ * without taking it, or NULL if the queue is empty. */
+cmd_t *cmdq_peek(cmdq_t *q)
+{
+    size_t head = atomic_load_explicit(&q->head,memory_order_relaxed);
+    if (head == q->_tail_cache) {
+        q->_tail_cache = atomic_load_explicit(&q->tail,memory_order_acquire);
+        if (head == q->_tail_cache) {
+            return NULL;
+        }
+    }
+    return &q->cmds[head & (q->size - 1)];
+}
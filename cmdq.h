@@ -0,0 +1,87 @@
+#ifndef CMDQ_H
+#define CMDQ_H
+
+#include <stdatomic.h>
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "seq.h"
+#include "arena.h"
+
+/* Wait-free single-producer/single-consumer ring of parsed commands. The
+ * control thread parses messages into commands and pushes them, the audio
+ * thread pops and applies them at the start of a block, so neither side
+ * ever blocks on the other. */
+
+#define CMDQ_CACHE_LINE 64
+
+typedef enum cmd_type_t {
+    cmd_NOTE,   /* add event at tick */
+    cmd_CLEAR,  /* remove all events acquired before epoch */
+    cmd_TEMPO,  /* set tick_len from tick, or everywhere if tick is
+                   CMD_ALL_TICKS */
+    cmd_REMOVE, /* remove the event at tick with frequency freq */
+    cmd_UNLINK, /* remove event */
+    cmd_REPLACE,/* put event at tick in place of old */
+    cmd_VOICES, /* set the track's voice budget */
+    cmd_ADOPT,  /* swap in lists when the track next gets to tick, or now
+                   if CMD_NOW, then hand back the old ones, whose events
+                   are all from before epoch */
+    cmd_HOLD,   /* apply no more commands until the control thread lets
+                   go, which it does once this is handed back */
+    cmd_FREE    /* event no longer referenced by the sequence, or if NULL,
+                   none acquired before epoch are */
+} cmd_type_t;
+
+#define CMD_ALL_TICKS SIZE_MAX
+#define CMD_NOW SIZE_MAX
+
+typedef struct cmd_t {
+    cmd_type_t type;
+    size_t tick;
+    union {
+        struct {
+            seq_event_t *event; /* cmd_NOTE, cmd_FREE, cmd_UNLINK, cmd_REPLACE */
+            seq_event_t *old;   /* cmd_REPLACE */
+        };
+        struct {
+            f64_t tick_len;     /* cmd_TEMPO, in samples */
+            int ramp;           /* to the next tempo point */
+        };
+        seq_lists_t *lists; /* cmd_ADOPT */
+        f64_t freq;         /* cmd_REMOVE */
+        size_t nvoices;     /* cmd_VOICES */
+    };
+    uint32_t epoch;         /* cmd_CLEAR, cmd_FREE, cmd_ADOPT */
+    uint32_t track;         /* all */
+} cmd_t;
+
+typedef struct cmdq_t {
+    cmd_t *cmds;
+    size_t size; /* a power of 2 */
+    /* written by the consumer */
+    _Atomic size_t head __attribute__((aligned(CMDQ_CACHE_LINE)));
+    size_t _tail_cache;
+    /* written by the producer */
+    _Atomic size_t tail __attribute__((aligned(CMDQ_CACHE_LINE)));
+    size_t _head_cache;
+    /* commands applied by the consumer, and commands lost because the
+     * queue was full or the consumer could not apply them */
+    _Atomic size_t n_applied __attribute__((aligned(CMDQ_CACHE_LINE)));
+    _Atomic size_t n_dropped;
+    arena_t *_arena;
+} cmdq_t;
+
+err_t cmdq_init(cmdq_t *q, size_t size, arena_t *arena);
+size_t cmdq_round(size_t size);
+size_t cmdq_mem_size(size_t size);
+void cmdq_destroy(cmdq_t *q);
+err_t cmdq_push(cmdq_t *q, cmd_t *c);
+int cmdq_pop(cmdq_t *q, cmd_t *c);
+cmd_t *cmdq_peek(cmdq_t *q);
+#define cmdq_applied(q) atomic_fetch_add_explicit(&(q)->n_applied,1,memory_order_relaxed)
+#define cmdq_dropped(q) atomic_fetch_add_explicit(&(q)->n_dropped,1,memory_order_relaxed)
+void cmdq_stats(cmdq_t *q, size_t *n_applied, size_t *n_dropped);
+
+#endif /* CMDQ_H */
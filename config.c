@@ -0,0 +1,205 @@
+/* Engine settings from the command line or a file */
+#include "config.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+
+typedef enum config_type_t {
+    config_SIZE,
+    config_F64,
+    config_INT,
+    config_ENUM,
+    config_SHED,  /* a comma separated list of engine_shed_t */
+    config_PATH   /* a char[ENGINE_PATH_LEN] */
+} config_type_t;
+
+static const char *steal_names[] = { "none", "oldest", "quietest", "release", NULL };
+static const char *phase_names[] = { "float", "fixed", NULL };
+static const char *isa_names[] = { "auto", "scalar", "sse2", "avx2", "avx512f", NULL };
+static const char *level_names[] = { "error", "warn", "info", "debug", NULL };
+static const char *shed_names[] = {
+    "none", "interp", "defer", "quietest", "oldest", NULL
+};
+
+typedef struct config_key_t {
+    const char *name;
+    config_type_t type;
+    size_t off;          /* in engine_init_t */
+    const char **names;  /* of a config_ENUM's values */
+} config_key_t;
+
+#define KEY(n,t,f) { n, t, offsetof(engine_init_t,f), NULL }
+#define ENUM_KEY(n,f,v) { n, config_ENUM, offsetof(engine_init_t,f), v }
+
+static const config_key_t keys[] = {
+    KEY("sr",config_F64,sr),
+    KEY("voices",config_SIZE,nvoices),
+    KEY("seq_len",config_SIZE,seq_len),
+    KEY("max_events",config_SIZE,max_events),
+    KEY("tick_len",config_F64,tick_len),
+    KEY("wavetable_len",config_SIZE,wavetable_len),
+    KEY("wavetable_nharm",config_SIZE,wavetable_nharm),
+    KEY("cmdq_size",config_SIZE,cmdq_size),
+    ENUM_KEY("isa",isa,isa_names),
+    ENUM_KEY("steal",steal,steal_names),
+    ENUM_KEY("phase",phase,phase_names),
+    KEY("cull_db",config_F64,cull_db),
+    KEY("threads",config_SIZE,nthreads),
+    KEY("rt_prio",config_INT,rt_prio),
+    KEY("max_block",config_SIZE,max_block),
+    KEY("shed_load",config_F64,shed_load),
+    { "shed", config_SHED, offsetof(engine_init_t,shed), shed_names },
+    KEY("tracks",config_SIZE,ntracks),
+    KEY("log_size",config_SIZE,log_size),
+    ENUM_KEY("log_level",log_level,level_names),
+    KEY("snap_dir",config_PATH,snap_dir)
+};
+
+/* The value of the enumeration with names that is spelt by the len
+ * characters at s, or -1 */
+static int enum_find(const char **names, const char *s, size_t len)
+{
+    int n;
+    for (n = 0; names[n]; n++) {
+        if ((strlen(names[n]) == len) && (strncmp(s,names[n],len) == 0)) {
+            return n;
+        }
+    }
+    return -1;
+}
+
+#define NKEYS (sizeof(keys)/sizeof(keys[0]))
+
+/* Sets the setting called key from the text val. Returns err_NFND if
+ * there is no such setting and err_EINVAL if val isn't one of its
+ * values. Whether the settings work together is up to engine_init. */
+err_t config_set(engine_init_t *ei, const char *key, const char *val)
+{
+    size_t n;
+    char *end;
+    for (n = 0; n < NKEYS; n++) {
+        if (strcmp(key,keys[n].name) == 0) {
+            break;
+        }
+    }
+    if (n == NKEYS) {
+        return err_NFND;
+    }
+    const config_key_t *k = &keys[n];
+    void *p = (char*)ei + k->off;
+    errno = 0;
+    switch (k->type) {
+        case config_SIZE: {
+            unsigned long long x = strtoull(val,&end,0);
+            if ((end == val) || *end || errno || (strchr(val,'-') != NULL)
+                    || (x > SIZE_MAX)) {
+                return err_EINVAL;
+            }
+            *(size_t*)p = x;
+            break;
+        }
+        case config_F64: {
+            double x = strtod(val,&end);
+            if ((end == val) || *end || errno) {
+                return err_EINVAL;
+            }
+            *(f64_t*)p = x;
+            break;
+        }
+        case config_INT: {
+            long x = strtol(val,&end,0);
+            if ((end == val) || *end || errno || (x < INT_MIN) || (x > INT_MAX)) {
+                return err_EINVAL;
+            }
+            *(int*)p = x;
+            break;
+        }
+        case config_ENUM: {
+            int x = enum_find(k->names,val,strlen(val));
+            if (x < 0) {
+                return err_EINVAL;
+            }
+            /* the enumerations are all int sized */
+            *(int*)p = x;
+            break;
+        }
+        case config_SHED: {
+            engine_shed_t shed[ENGINE_NSHED] = { engine_shed_NONE };
+            const char *s = val;
+            for (n = 0;; n++) {
+                size_t len = strcspn(s,",");
+                int x = enum_find(k->names,s,len);
+                if ((x < 0) || (n == ENGINE_NSHED)) {
+                    return err_EINVAL;
+                }
+                shed[n] = x;
+                if (!s[len]) {
+                    break;
+                }
+                s += len + 1;
+            }
+            memcpy(p,shed,sizeof(shed));
+            break;
+        }
+        case config_PATH:
+            if (strlen(val) >= ENGINE_PATH_LEN) {
+                return err_EINVAL;
+            }
+            strcpy(p,val);
+            break;
+    }
+    return err_NONE;
+}
+
+/* Sets a setting from key=value */
+err_t config_set_str(engine_init_t *ei, const char *kv)
+{
+    char key[CONFIG_LINE_LEN];
+    const char *eq = strchr(kv,'=');
+    if (!eq || ((size_t)(eq - kv) >= sizeof(key))) {
+        return err_EINVAL;
+    }
+    memcpy(key,kv,eq - kv);
+    key[eq - kv] = '\0';
+    return config_set(ei,key,eq + 1);
+}
+
+/* Sets each setting in the file at path. On an error *line is the line it
+ * was on, or 0 if the file could not be read. Settings before it are
+ * kept. */
+err_t config_load(engine_init_t *ei, const char *path, size_t *line)
+{
+    char buf[CONFIG_LINE_LEN], *key, *val, *lasts;
+    FILE *f = fopen(path,"r");
+    err_t err = err_NONE;
+    *line = 0;
+    if (!f) {
+        return err_NFND;
+    }
+    while (fgets(buf,sizeof(buf),f)) {
+        (*line)++;
+        if (!strchr(buf,'\n') && !feof(f)) {
+            err = err_EINVAL;
+            break;
+        }
+        buf[strcspn(buf,"#\n")] = '\0';
+        if (!(key = strtok_r(buf," \t\r=",&lasts))) {
+            continue;
+        }
+        val = strtok_r(NULL," \t\r=",&lasts);
+        if (!val || strtok_r(NULL," \t\r",&lasts)) {
+            err = err_EINVAL;
+            break;
+        }
+        if ((err = config_set(ei,key,val)) != err_NONE) {
+            break;
+        }
+    }
+    if ((err == err_NONE) && ferror(f)) {
+        err = err_EINVAL;
+    }
+    fclose(f);
+    return err;
+}
@@ -0,0 +1,26 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "engine.h"
+
+/* Engine settings given at startup rather than compiled in. Each is a key
+ * and a value, from the command line as key=value or from a file of
+ *     key value
+ * lines, where # starts a comment. The keys are the fields of
+ * engine_init_t, with voices, threads and tracks for nvoices, nthreads and
+ * ntracks. Enumerations are given by name: isa auto|scalar|sse2|avx2|avx512f,
+ * steal none|oldest|quietest|release, phase float|fixed and log_level
+ * error|warn|info|debug. shed is a comma separated list of the steps
+ * none|interp|defer|quietest|oldest, such as interp,defer,quietest.
+ * snap_dir is a path, which can't have whitespace in a file. */
+
+#define CONFIG_LINE_LEN 256
+
+err_t config_set(engine_init_t *ei, const char *key, const char *val);
+err_t config_set_str(engine_init_t *ei, const char *kv);
+err_t config_load(engine_init_t *ei, const char *path, size_t *line);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,1491 @@
+/* Sequencer and voice engine */
+#include "engine.h"
+#include <stdio.h>
+#include <math.h>
+
+/* Logged messages go through a ring to a drain thread, so this is safe
+ * on the control and audio threads alike */
+#define engine_log(e,lvl,...) logq_log(&(e)->log,lvl,__VA_ARGS__)
+
+/* Points the track at its first tick with events from tick on, or where a
+ * pattern waits to be swapped in if that is sooner, or the end of its loop
+ * if there are none */
+static void track_seek(engine_track_t *t, size_t tick)
+{
+    t->next_tick = seq_next_tick(&t->seq,tick);
+    if (t->_adopt && (t->_adopt_tick >= tick) && (t->_adopt_tick < t->next_tick)) {
+        t->next_tick = t->_adopt_tick;
+    }
+    t->next_time = t->loop_start + (t->next_tick < t->seq._seq_len ?
+        seq_tick_time(&t->seq,t->next_tick) : t->seq.loop_time);
+}
+
+static void stats_init(engine_stats_t *st)
+{
+    stats_hist_init(&st->proc_ns);
+    stats_hist_init(&st->sched_ns);
+    stats_hist_init(&st->render_ns);
+    stats_hist_init(&st->load);
+    stats_hist_init(&st->voices);
+    atomic_init(&st->n_blocks,0);
+    atomic_init(&st->n_late,0);
+    atomic_init(&st->n_xruns,0);
+    atomic_init(&st->n_notes_dropped,0);
+    atomic_init(&st->n_stolen,0);
+    atomic_init(&st->n_retrig,0);
+    atomic_init(&st->n_culled,0);
+    atomic_init(&st->n_culled_samps,0);
+    atomic_init(&st->n_silent,0);
+    atomic_init(&st->n_shed,0);
+    atomic_init(&st->n_shed_near,0);
+    atomic_init(&st->n_deferred,0);
+    atomic_init(&st->n_deferred_lost,0);
+    atomic_init(&st->n_shed_voices,0);
+}
+
+/* The settings of track n */
+static engine_track_init_t track_init(engine_init_t *ei, size_t n)
+{
+    return ei->tracks ? ei->tracks[n] :
+        (engine_track_init_t) {
+            .seq_len = ei->seq_len,
+            .tick_len = ei->tick_len,
+            .max_events = ei->max_events,
+            .nvoices = ei->nvoices
+        };
+}
+
+/* All the memory the audio thread uses, the voices, tables, queues,
+ * sequences and mix buffers, is taken from one arena made here, so
+ * ei alone decides how much is used. Staged and loaded patterns are still
+ * built on the heap, on the control thread. */
+err_t engine_init(engine_t *e, engine_init_t *ei)
+{
+    err_t err;
+    size_t n, nevents = 0, memsz, qsize = cmdq_round(ei->cmdq_size);
+    _MZ(e,engine_t,1);
+    e->sr = ei->sr;
+    stats_init(&e->stats);
+    atomic_init(&e->_hold,0);
+    if ((ei->ntracks == 0) || (ei->nthreads == 0) || (ei->max_block == 0)
+            || !(ei->shed_load >= 0)) {
+        err = err_EINVAL;
+        goto fail;
+    }
+    for (n = 0; n < ENGINE_NSHED; n++) {
+        if ((ei->shed[n] < engine_shed_NONE) || (ei->shed[n] >= engine_NSHED_KINDS)) {
+            err = err_EINVAL;
+            goto fail;
+        }
+    }
+    if (!memchr(ei->snap_dir,'\0',ENGINE_PATH_LEN)) {
+        err = err_EINVAL;
+        goto fail;
+    }
+    strcpy(e->_snap_dir,ei->snap_dir);
+    e->shed_load = ei->shed_load;
+    memcpy(e->shed,ei->shed,sizeof(e->shed));
+    if ((ei->phase == synth_bank_phase_FIXED)
+            && (ei->wavetable_len & (ei->wavetable_len - 1))) {
+        /* every level's length must be a power of 2 */
+        err = err_EINVAL;
+        goto fail;
+    }
+    synth_bank_init_t sbi = {
+        .nvoices = ei->nvoices,
+        .isa = ei->isa,
+        .steal = ei->steal,
+        .phase = ei->phase,
+        .ngroups = ei->ntracks,
+        .arena = &e->arena
+    };
+    /* each thread's buffer on its own cache lines */
+    e->_mix_stride = (ei->max_block * sizeof(f64_t) + WORKERS_CACHE_LINE - 1)
+        / WORKERS_CACHE_LINE * WORKERS_CACHE_LINE / sizeof(f64_t);
+    memsz = logq_mem_size(ei->log_size)
+        + wtset_mem_size(ei->sr,ei->wavetable_len,ei->wavetable_nharm)
+        + synth_bank_mem_size(&sbi)
+        + cmdq_mem_size(qsize)
+        + arena_size(ei->ntracks * sizeof(engine_track_t))
+        + arena_size(ei->ntracks * sizeof(size_t))
+        + arena_size(ei->nthreads * sizeof(synth_bank_scratch_t))
+        + arena_size(ei->nthreads * e->_mix_stride * sizeof(f64_t))
+        + arena_size(ei->nvoices * sizeof(engine_onset_t));
+    for (n = 0; n < ei->ntracks; n++) {
+        engine_track_init_t ti = track_init(ei,n);
+        /* Enough events for max_events in the sequence with a full queue
+         * of notes on the way */
+        memsz += seq_mem_size(ti.seq_len,ti.max_events + qsize);
+        nevents += ti.max_events + qsize;
+    }
+    /* Every event is either in a sequence or in a queue, and there is at
+     * most one clear acknowledgement per queued command, so this never
+     * fills */
+    memsz += cmdq_mem_size(nevents + qsize);
+    if ((err = arena_init(&e->arena,memsz)) != err_NONE) {
+        goto fail;
+    }
+    logq_init_t li = LOGQ_INIT_DEFAULT;
+    li.size = ei->log_size;
+    li.level = ei->log_level;
+    li.out = ei->log_out;
+    li.arena = &e->arena;
+    if ((err = logq_init(&e->log,&li)) != err_NONE) {
+        goto fail;
+    }
+    if ((err = wtset_init(&e->wtset,
+                          ei->sr,
+                          ei->wavetable_len,
+                          ei->wavetable_nharm,
+                          &e->arena)) != err_NONE) {
+        goto fail;
+    }
+    /* the full table is level 0 */
+    e->synthproc = (synth_vc_proc_t) {
+        .sr = ei->sr,
+        .wt = e->wtset.wt,
+        .len = e->wtset.lvl[0].len,
+        .set = &e->wtset,
+        .cull = powf(10.f,ei->cull_db / 20.f)
+    };
+    if ((err = synth_bank_init(&e->bank,&sbi)) != err_NONE) {
+        goto fail;
+    }
+    if ((err = cmdq_init(&e->cmdq,qsize,&e->arena)) != err_NONE) {
+        goto fail;
+    }
+    e->tracks = arena_alloc(&e->arena,ei->ntracks * sizeof(engine_track_t));
+    e->_heap = arena_alloc(&e->arena,ei->ntracks * sizeof(size_t));
+    if (!(e->tracks && e->_heap)) {
+        err = err_MEM;
+        goto fail;
+    }
+    for (n = 0; n < ei->ntracks; n++) {
+        engine_track_init_t ti = track_init(ei,n);
+        engine_track_t *t = &e->tracks[n];
+        if ((err = seq_init(&t->seq,
+                            ti.seq_len,
+                            ti.tick_len * ei->sr,
+                            ti.max_events + qsize,
+                            &e->arena)) != err_NONE) {
+            goto fail;
+        }
+        e->ntracks++;
+        track_seek(t,0);
+        t->_hpos = n;
+        e->_heap[n] = n;
+        synth_bank_set_budget(&e->bank,n,ti.nvoices);
+        t->nvoices = ti.nvoices;
+    }
+    if ((err = cmdq_init(&e->freeq,nevents + qsize,&e->arena)) != err_NONE) {
+        goto fail;
+    }
+    e->_scratch = arena_alloc(&e->arena,ei->nthreads * sizeof(synth_bank_scratch_t));
+    e->_mix = arena_alloc(&e->arena,ei->nthreads * e->_mix_stride * sizeof(f64_t));
+    /* a block with more onsets than voices steals from itself anyway, so
+     * the rest are started straight away */
+    e->_onsets = arena_alloc(&e->arena,ei->nvoices * sizeof(engine_onset_t));
+    e->_max_onsets = ei->nvoices;
+    if (!(e->_scratch && e->_mix && (e->_onsets || !ei->nvoices))) {
+        err = err_MEM;
+        goto fail;
+    }
+    workers_init_t wi = WORKERS_INIT_DEFAULT;
+    wi.nthreads = ei->nthreads;
+    wi.rt_prio = ei->rt_prio;
+    if ((err = workers_init(&e->workers,&wi)) != err_NONE) {
+        goto fail;
+    }
+    return err_NONE;
+fail:
+    engine_destroy(e);
+    return err;
+}
+
+/* Only call once the audio thread has stopped calling engine_proc. Queued
+ * and returned events go with the pool. */
+void engine_destroy(engine_t *e)
+{
+    workers_destroy(&e->workers);
+    size_t n;
+    for (n = 0; n < e->ntracks; n++) {
+        engine_track_t *t = &e->tracks[n];
+        seq_lists_t *l[2] = { t->_adopt, t->stage };
+        size_t k;
+        for (k = 0; k < 2; k++) {
+            if (l[k]) {
+                seq_lists_destroy(l[k]);
+                _F(l[k]);
+            }
+        }
+        seq_destroy(&t->seq);
+    }
+    /* lists on their way to or from the audio thread */
+    cmd_t c;
+    while (cmdq_pop(&e->cmdq,&c) || cmdq_pop(&e->freeq,&c)) {
+        if (c.type == cmd_ADOPT) {
+            seq_lists_destroy(c.lists);
+            _F(c.lists);
+        }
+    }
+    cmdq_destroy(&e->cmdq);
+    cmdq_destroy(&e->freeq);
+    synth_bank_destroy(&e->bank);
+    wtset_destroy(&e->wtset);
+    logq_destroy(&e->log);
+    arena_destroy(&e->arena);
+    _MZ(e,engine_t,1);
+}
+
+/* Writes the snapshot asked for with "save". Only called by the control
+ * thread while the audio thread is holding. */
+static void save(engine_t *e)
+{
+    seq_t **seqs = _M(seq_t*,e->ntracks);
+    size_t *nvoices = _M(size_t,e->ntracks), n;
+    err_t err = err_MEM;
+    if (seqs && nvoices) {
+        for (n = 0; n < e->ntracks; n++) {
+            seqs[n] = &e->tracks[n].seq;
+            nvoices[n] = e->tracks[n].nvoices;
+        }
+        err = snap_save(e->_save_path,e->sr,e->ntracks,seqs,nvoices);
+    }
+    if (err != err_NONE) {
+        engine_log(e,logq_ERROR,"could not save to %s",e->_save_path);
+    } else {
+        engine_log(e,logq_INFO,"saved to %s",e->_save_path);
+    }
+    e->_save_path[0] = '\0';
+    _F(seqs);
+    _F(nvoices);
+}
+
+/* Puts the events the audio thread has given back in the pool. Only
+ * called by the control thread. */
+void engine_free_returned(engine_t *e)
+{
+    cmd_t c;
+    while (cmdq_pop(&e->freeq,&c)) {
+        seq_t *s = &e->tracks[c.track].seq;
+        switch (c.type) {
+            case cmd_HOLD:
+                /* the audio thread has applied everything before the save
+                 * and leaves the sequences alone until let go */
+                save(e);
+                atomic_store_explicit(&e->_hold,0,memory_order_release);
+                break;
+            case cmd_ADOPT:
+                seq_pool_release_before(s,c.epoch);
+                seq_lists_destroy(c.lists);
+                _F(c.lists);
+                break;
+            default:
+                if (c.event) {
+                    seq_event_release(s,c.event);
+                } else {
+                    seq_pool_release_before(s,c.epoch);
+                }
+                break;
+        }
+    }
+}
+
+/* Queues a command for the audio thread, noting if the queue was full */
+static err_t push(engine_t *e, cmd_t *c)
+{
+    err_t err = cmdq_push(&e->cmdq,c);
+    if (err != err_NONE) {
+        engine_log(e,logq_WARN,"track %u: command queue full",c->track);
+    }
+    return err;
+}
+
+/* Takes an event from track's pool, noting if there are none left */
+static seq_event_t *acquire(engine_t *e, size_t track)
+{
+    seq_event_t *se = seq_event_acquire(&e->tracks[track].seq);
+    if (!se) {
+        engine_log(e,logq_WARN,"track %zu: out of events",track);
+    }
+    return se;
+}
+
+static int chk_freq(seq_event_t *se, void *data)
+{
+    return seq_event_chk_freq(se,*(f64_t*)data);
+}
+
+/* While a track is staging (see stage_begin) the push functions below
+ * change its staged pattern on the control thread instead of queueing
+ * commands, and only events of the staged pattern have IDs that can be
+ * found. */
+
+/* Queues an event taken from track's pool and returns its ID, or puts it
+ * back and returns 0 if the tick is past the end or the queue is full */
+static seq_event_id_t push_note(engine_t *e, size_t track, seq_event_t *se, size_t tick)
+{
+    engine_track_t *t = &e->tracks[track];
+    seq_t *s = &t->seq;
+    cmd_t c = { .type = cmd_NOTE, .tick = tick, .event = se, .track = track };
+    if (tick >= s->_seq_len) {
+        seq_event_release(s,se);
+        engine_log(e,logq_INFO,"track %zu: tick %zu past the end",track,tick);
+        e->n_bad++;
+        return 0;
+    }
+    if (t->stage) {
+        seq_lists_add(s,t->stage,se,tick);
+    } else if (push(e,&c) != err_NONE) {
+        seq_event_release(s,se);
+        return 0;
+    }
+    return seq_event_id(s,se);
+}
+
+static void push_clear(engine_t *e, size_t track)
+{
+    engine_track_t *t = &e->tracks[track];
+    if (t->stage) {
+        seq_lists_release(&t->seq,t->stage);
+        return;
+    }
+    /* every event of the old epoch is in the sequence or was already
+     * given back, so all can be released once the clear is applied */
+    cmd_t c = {
+        .type = cmd_CLEAR,
+        .epoch = seq_pool_new_epoch(&e->tracks[track].seq),
+        .track = track
+    };
+    push(e,&c);
+}
+
+/* From tick on, or everywhere if tick is CMD_ALL_TICKS */
+/* Ticks shorter than SEQ_TICK_MIN samples are made that long */
+static void push_tempo(engine_t *e, size_t track, f64_t tempo_s, size_t tick, int ramp)
+{
+    seq_lists_t *l = e->tracks[track].stage;
+    f64_t tick_len = tempo_s * e->sr;
+    if (!(tick_len >= SEQ_TICK_MIN)) {
+        tick_len = SEQ_TICK_MIN;
+    }
+    if (l) {
+        if (tick == CMD_ALL_TICKS) {
+            seq_lists_tempo_reset(l,tick_len);
+        } else if (seq_lists_tempo_set(l,tick,tick_len,ramp) != err_NONE) {
+            e->n_bad++;
+        }
+        return;
+    }
+    cmd_t c = {
+        .type = cmd_TEMPO,
+        .tick = tick,
+        .tick_len = tick_len,
+        .ramp = ramp,
+        .track = track
+    };
+    push(e,&c);
+}
+
+static void push_remove(engine_t *e, size_t track, size_t tick, f64_t freq)
+{
+    engine_track_t *t = &e->tracks[track];
+    if (t->stage) {
+        seq_event_t *se = seq_lists_remove(&t->seq,t->stage,tick,chk_freq,&freq);
+        if (se) {
+            seq_event_release(&t->seq,se);
+        }
+        return;
+    }
+    cmd_t c = { .type = cmd_REMOVE, .tick = tick, .freq = freq, .track = track };
+    push(e,&c);
+}
+
+/* The ID is dropped once the removal is queued so it is only ever asked
+ * for once. Returns err_NFND if there is no such event. */
+static err_t push_unnote(engine_t *e, size_t track, seq_event_id_t id)
+{
+    seq_t *s = &e->tracks[track].seq;
+    seq_event_t *se = seq_event_lookup(s,id);
+    if (!se) {
+        return err_NFND;
+    }
+    seq_lists_t *l = e->tracks[track].stage;
+    if (l) {
+        /* releasing it drops its ID */
+        seq_lists_unlink(s,l,se);
+        seq_event_release(s,se);
+        return err_NONE;
+    }
+    cmd_t c = { .type = cmd_UNLINK, .event = se, .track = track };
+    if (push(e,&c) == err_NONE) {
+        seq_event_drop_id(s,id);
+    }
+    return err_NONE;
+}
+
+/* Queues se, taken from the pool, to replace the event named by id, which
+ * then names se. se is put back if the queue is full, but not if there is
+ * no such event, when err_NFND is returned, or if a staged event is moved
+ * past the end, when err_EINVAL is. */
+static err_t push_update(engine_t *e, size_t track, seq_event_id_t id, seq_event_t *se, size_t tick)
+{
+    seq_t *s = &e->tracks[track].seq;
+    seq_event_t *old = seq_event_lookup(s,id);
+    seq_lists_t *l = e->tracks[track].stage;
+    if (!old) {
+        return err_NFND;
+    }
+    if (l) {
+        if (tick >= s->_seq_len) {
+            return err_EINVAL;
+        }
+        seq_lists_unlink(s,l,old);
+        seq_lists_add(s,l,se,tick);
+        seq_event_move_id(s,id,se);
+        seq_event_release(s,old);
+        return err_NONE;
+    }
+    cmd_t c = { .type = cmd_REPLACE, .tick = tick, .event = se, .old = old, .track = track };
+    if (push(e,&c) != err_NONE) {
+        seq_event_release(s,se);
+    } else {
+        seq_event_move_id(s,id,se);
+    }
+    return err_NONE;
+}
+
+static void push_voices(engine_t *e, size_t track, size_t nvoices)
+{
+    cmd_t c = { .type = cmd_VOICES, .nvoices = nvoices, .track = track };
+    if (push(e,&c) == err_NONE) {
+        e->tracks[track].nvoices = nvoices;
+    }
+}
+
+/* Puts the path in the snapshot directory that path names in buf, which
+ * has room for ENGINE_PATH_LEN bytes. Paths come from any sender, so
+ * absolute ones and ones with a ".." component are refused, as is
+ * everything if there is no snapshot directory. */
+static err_t snap_path(engine_t *e, const char *path, char *buf)
+{
+    const char *p;
+    size_t len;
+    int n;
+    if (!e->_snap_dir[0] || (path[0] == '/')) {
+        return err_EINVAL;
+    }
+    for (p = path; *p; p += len + (p[len] == '/')) {
+        len = strcspn(p,"/");
+        if ((len == 2) && (p[0] == '.') && (p[1] == '.')) {
+            return err_EINVAL;
+        }
+    }
+    n = snprintf(buf,ENGINE_PATH_LEN,"%s/%s",e->_snap_dir,path);
+    return (n < 0) || (n >= ENGINE_PATH_LEN) ? err_EINVAL : err_NONE;
+}
+
+/* Asks for the sequences to be saved to path in the snapshot directory
+ * once every command so far has been applied. Only one save can be
+ * waiting at once. */
+static err_t push_save(engine_t *e, const char *path)
+{
+    cmd_t c = { .type = cmd_HOLD };
+    if (e->_save_path[0]) {
+        return err_EINVAL;
+    }
+    if (snap_path(e,path,e->_save_path) != err_NONE) {
+        e->_save_path[0] = '\0';
+        return err_EINVAL;
+    }
+    if (push(e,&c) != err_NONE) {
+        e->_save_path[0] = '\0';
+        return err_FULL;
+    }
+    return err_NONE;
+}
+
+/* Starts staging a pattern for track. Until it is committed or discarded
+ * the track's notes, clears, tempo changes and removals go to the staged
+ * pattern while the track plays on as it was. The pattern starts empty and
+ * keeps the track's tempo map unless given one of its own, which then
+ * needs a point at tick 0. The staged events are of a new epoch so that
+ * the old ones can all be released once the pattern is swapped in. */
+static err_t stage_begin(engine_t *e, size_t track)
+{
+    engine_track_t *t = &e->tracks[track];
+    if (t->stage) {
+        return err_EINVAL;
+    }
+    if (!(t->stage = _M(seq_lists_t,1))) {
+        return err_MEM;
+    }
+    if (seq_lists_init(t->stage,t->seq._seq_len) != err_NONE) {
+        _F(t->stage);
+        t->stage = NULL;
+        return err_MEM;
+    }
+    t->_stage_prev_epoch = t->seq._epoch;
+    seq_pool_new_epoch(&t->seq);
+    return err_NONE;
+}
+
+/* Throws the staged pattern of track away. The IDs of the events it was
+ * playing work again. */
+static err_t stage_discard(engine_t *e, size_t track)
+{
+    engine_track_t *t = &e->tracks[track];
+    if (!t->stage) {
+        return err_EINVAL;
+    }
+    seq_lists_release(&t->seq,t->stage);
+    seq_lists_destroy(t->stage);
+    _F(t->stage);
+    t->stage = NULL;
+    /* nothing of the staging epoch is left */
+    t->seq._epoch = t->_stage_prev_epoch;
+    return err_NONE;
+}
+
+/* Queues the staged pattern of track to be swapped in whole the next time
+ * the track reaches tick, where tick 0 is the start of its next loop.
+ * Commands queued after it, for any track, wait until it has been. */
+static err_t stage_commit(engine_t *e, size_t track, size_t tick)
+{
+    engine_track_t *t = &e->tracks[track];
+    cmd_t c = {
+        .type = cmd_ADOPT,
+        .tick = tick,
+        .lists = t->stage,
+        .epoch = t->seq._epoch,
+        .track = track
+    };
+    if (!t->stage || (tick >= t->seq._seq_len)
+            || (seq_lists_check_tempo(t->stage) != err_NONE)) {
+        return err_EINVAL;
+    }
+    if (push(e,&c) != err_NONE) {
+        return err_FULL;
+    }
+    t->stage = NULL;
+    return err_NONE;
+}
+
+/* Builds lists for track from the snapshot's track n, out of events from
+ * the track's pool of a new epoch. Returns NULL, having put back any
+ * events taken and the old epoch, if the snapshot's events don't fit the
+ * track. */
+static seq_lists_t *load_lists(engine_t *e, size_t track, snap_t *sn, uint32_t *epoch)
+{
+    const snap_track_t *st = &sn->tracks[track];
+    const snap_event_t *ev = snap_events(sn,track);
+    seq_t *s = &e->tracks[track].seq;
+    seq_lists_t *l = _M(seq_lists_t,1);
+    size_t n;
+    uint32_t prev_epoch = s->_epoch;
+    if (!l || (seq_lists_init(l,st->seq_len) != err_NONE)) {
+        _F(l);
+        return NULL;
+    }
+    for (n = 0; n < st->ntempo; n++) {
+        l->tempo[n] = (seq_tempo_pt_t) {
+            .tick = st->tempo[n].tick,
+            .tick_len = st->tempo[n].tick_len * e->sr,
+            .ramp = st->tempo[n].ramp != 0
+        };
+    }
+    l->ntempo = st->ntempo;
+    if (seq_lists_check_tempo(l) != err_NONE) {
+        goto fail;
+    }
+    *epoch = seq_pool_new_epoch(s);
+    for (n = 0; n < st->nevents; n++) {
+        seq_event_t *se = seq_event_acquire(s);
+        if (!se) {
+            goto fail;
+        }
+        snap_event_get(&ev[n],se);
+        /* the file may be damaged or hand made, so as for a message */
+        if ((seq_event_check(se) != err_NONE)
+                || (seq_lists_add(s,l,se,ev[n].tick) != err_NONE)) {
+            seq_event_release(s,se);
+            goto fail;
+        }
+    }
+    return l;
+fail:
+    seq_lists_release(s,l);
+    seq_lists_destroy(l);
+    _F(l);
+    /* nothing of the new epoch is left, so the track's note IDs stay
+     * good */
+    s->_epoch = prev_epoch;
+    return NULL;
+}
+
+/* Replaces the events, tempo maps and voice budgets of the first tracks
+ * with those in the snapshot at path in the snapshot directory. The events are copied straight from
+ * the mapped file into the pools and linked into lists that the audio
+ * thread swaps in whole, so the cost is a copy per event and nothing on
+ * the audio thread depends on how many there are. Each track needs as many
+ * free events as it will have, as its old ones are only freed once the new
+ * ones are in. Tracks after a failed one are left as they were. */
+static err_t load(engine_t *e, const char *path, size_t *nevents)
+{
+    snap_t sn;
+    err_t err;
+    size_t n;
+    char buf[ENGINE_PATH_LEN];
+    *nevents = 0;
+    if ((err = snap_path(e,path,buf)) != err_NONE) {
+        return err;
+    }
+    if ((err = snap_open(&sn,buf)) != err_NONE) {
+        return err;
+    }
+    if (sn.hdr->ntracks > e->ntracks) {
+        err = err_EINVAL;
+        goto done;
+    }
+    for (n = 0; n < sn.hdr->ntracks; n++) {
+        seq_t *s = &e->tracks[n].seq;
+        if ((sn.tracks[n].seq_len != s->_seq_len) || e->tracks[n].stage) {
+            err = err_EINVAL;
+            goto done;
+        }
+        if (sn.tracks[n].nevents > s->_nfree) {
+            err = err_FULL;
+            goto done;
+        }
+    }
+    for (n = 0; n < sn.hdr->ntracks; n++) {
+        seq_t *s = &e->tracks[n].seq;
+        cmd_t c = { .type = cmd_ADOPT, .tick = CMD_NOW, .track = n };
+        if (!(c.lists = load_lists(e,n,&sn,&c.epoch))) {
+            err = err_EINVAL;
+            goto done;
+        }
+        if (push(e,&c) != err_NONE) {
+            seq_lists_release(s,c.lists);
+            seq_lists_destroy(c.lists);
+            _F(c.lists);
+            err = err_FULL;
+            goto done;
+        }
+        push_voices(e,n,sn.tracks[n].nvoices);
+        *nevents += sn.tracks[n].nevents;
+    }
+done:
+    snap_close(&sn);
+    return err;
+}
+
+static void reply_text(engine_t *e, seq_event_id_t id)
+{
+    int n = snprintf(e->reply + e->reply_len,ENGINE_REPLY_LEN - e->reply_len,
+                     "id %llu\n",(unsigned long long)id);
+    if ((n > 0) && (e->reply_len + n < ENGINE_REPLY_LEN)) {
+        e->reply_len += n;
+        e->_reply_count++;
+    }
+}
+
+static void reply_bin(engine_t *e, seq_event_id_t id)
+{
+    size_t n = proto_put_id((uint8_t*)e->reply + e->reply_len,
+                            ENGINE_REPLY_LEN - e->reply_len,id);
+    if (n) {
+        e->reply_len += n;
+        e->_reply_count++;
+    }
+}
+
+/* Parses a text message into a command for the audio thread. Messages that
+ * can't be parsed are counted in n_bad. Only called by the control
+ * thread. */
+void engine_parse_mess(engine_t *e, char *buf)
+{
+    char *sep1 = " ", *sep2 = "\n",
+         *lasts;
+    size_t track = e->_track;
+    seq_t *s = &e->tracks[track].seq;
+    engine_log(e,logq_DEBUG,"track %zu: %s",track,buf);
+    strtok_r(buf,sep1,&lasts);
+    if (strcmp(buf,"note") == 0) {
+        seq_event_t *tmp = acquire(e,track);
+        if (!tmp) {
+            reply_text(e,0);
+            return;
+        }
+        char *lasts2;
+        if (lasts) {
+            strtok_r(lasts,sep2,&lasts2);
+        }
+        size_t tick;
+        if (seq_event_init_from_str(tmp,&tick,lasts)
+                != err_NONE) {
+            seq_event_release(s,tmp);
+            e->n_bad++;
+            reply_text(e,0);
+            return;
+        }
+        reply_text(e,push_note(e,track,tmp,tick));
+    } else if (strcmp(buf,"clear") == 0) {
+        push_clear(e,track);
+    } else if (strcmp(buf,"tempo") == 0) {
+        char *lasts2;
+        if (lasts) {
+            strtok_r(lasts,sep2,&lasts2);
+        }
+        /* the tick length, then optionally the tick it is from and
+         * "ramp" to change it gradually up to the next tempo point */
+        f64_t tempo_s = 1.; /* paranoid, don't set tempo to garbage */
+        size_t tick;
+        char shape[8] = "";
+        int nargs = lasts ? sscanf(lasts,"%f %zu %7s",&tempo_s,&tick,shape) : 0;
+        if ((nargs < 1) || !isfinite(tempo_s) || !(tempo_s * e->sr >= SEQ_TICK_MIN)
+                || ((nargs == 3) && strcmp(shape,"ramp"))) {
+            e->n_bad++;
+        } else {
+            push_tempo(e,track,tempo_s,nargs > 1 ? tick : CMD_ALL_TICKS,nargs == 3);
+        }
+    } else if (strcmp(buf,"remove") == 0) {
+        char *lasts2;
+        if (lasts) {
+            strtok_r(lasts,sep2,&lasts2);
+        }
+        /* either the tick and frequency or the ID of the note */
+        unsigned long long arg;
+        f64_t freq;
+        int nargs = lasts ? sscanf(lasts,"%llu %f",&arg,&freq) : 0;
+        if (nargs == 2) {
+            push_remove(e,track,arg,freq);
+        } else if ((nargs != 1) || (push_unnote(e,track,arg) != err_NONE)) {
+            e->n_bad++;
+        }
+    } else if (strcmp(buf,"update") == 0) {
+        char *lasts2;
+        if (lasts) {
+            strtok_r(lasts,sep2,&lasts2);
+        }
+        /* the ID then the note as it should now be */
+        unsigned long long id;
+        int off;
+        size_t tick;
+        seq_event_t *tmp;
+        if (!(lasts && (sscanf(lasts,"%llu%n",&id,&off) == 1))) {
+            e->n_bad++;
+            return;
+        }
+        if (!(tmp = acquire(e,track))) {
+            e->n_bad++;
+            return;
+        }
+        if ((seq_event_init_from_str(tmp,&tick,lasts + off) != err_NONE)
+                || (push_update(e,track,id,tmp,tick) != err_NONE)) {
+            seq_event_release(s,tmp);
+            e->n_bad++;
+        }
+    } else if ((strcmp(buf,"track") == 0) || (strcmp(buf,"voices") == 0)) {
+        char *lasts2;
+        if (lasts) {
+            strtok_r(lasts,sep2,&lasts2);
+        }
+        size_t n;
+        if (!(lasts && (sscanf(lasts,"%zu",&n) == 1))) {
+            e->n_bad++;
+        } else if (buf[0] == 'v') {
+            push_voices(e,track,n);
+        } else if (n < e->ntracks) {
+            /* the messages after this one are for track n */
+            e->_track = n;
+        } else {
+            e->n_bad++;
+        }
+    } else if (strcmp(buf,"log") == 0) {
+        /* the most verbose level to keep from now on */
+        char *lasts2;
+        logq_level_t level;
+        if (lasts) {
+            strtok_r(lasts,sep2,&lasts2);
+        }
+        if (lasts && (logq_level_from_str(&level,lasts) == err_NONE)) {
+            logq_set_level(&e->log,level);
+        } else {
+            e->n_bad++;
+        }
+    } else if ((strcmp(buf,"save") == 0) || (strcmp(buf,"load") == 0)) {
+        /* the path is the rest of the line */
+        char *lasts2;
+        size_t nevents;
+        if (lasts) {
+            strtok_r(lasts,sep2,&lasts2);
+        }
+        if (!(lasts && *lasts)) {
+            e->n_bad++;
+        } else if (buf[0] == 's') {
+            if (push_save(e,lasts) != err_NONE) {
+                engine_log(e,logq_WARN,"could not save to %s",lasts);
+                e->n_bad++;
+            }
+        } else if (load(e,lasts,&nevents) != err_NONE) {
+            engine_log(e,logq_WARN,"could not load %s",lasts);
+            e->n_bad++;
+        } else {
+            engine_log(e,logq_INFO,"loaded %zu events from %s",nevents,lasts);
+        }
+    } else if ((strcmp(buf,"stage") == 0) || (strcmp(buf,"discard") == 0)) {
+        if ((buf[0] == 's' ? stage_begin(e,track) : stage_discard(e,track))
+                != err_NONE) {
+            e->n_bad++;
+        }
+    } else if (strcmp(buf,"commit") == 0) {
+        /* at the start of the next loop unless a tick is given */
+        size_t tick = 0;
+        if (lasts && *lasts && (sscanf(lasts,"%zu",&tick) != 1)) {
+            e->n_bad++;
+        } else if (stage_commit(e,track,tick) != err_NONE) {
+            engine_log(e,logq_WARN,"track %zu: could not commit",track);
+            e->n_bad++;
+        }
+    } else if (strcmp(buf,"stats") == 0) {
+        e->reply_len += engine_stats_str(e,e->reply + e->reply_len,
+                                         ENGINE_REPLY_LEN - e->reply_len);
+    } else if (strcmp(buf,"quit") == 0) {
+        engine_log(e,logq_INFO,"quitting");
+        e->quit = 1;
+    } else {
+        e->n_bad++;
+    }
+}
+
+/* Parses a binary datagram (see proto.h). A message that is malformed is
+ * counted in n_bad, and if it can't be skipped so is the rest of the
+ * datagram. Only called by the control thread. */
+void engine_parse_bin(engine_t *e, const void *buf, size_t len)
+{
+    proto_dec_t d;
+    proto_msg_t m;
+    err_t err;
+    if (proto_dec_init(&d,buf,len) != err_NONE) {
+        e->n_bad++;
+        return;
+    }
+    while ((err = proto_dec_next(&d,&m)) != err_NFND) {
+        if ((err != err_NONE) || (m.track >= e->ntracks)) {
+            if (m.type == proto_type_NOTE) {
+                reply_bin(e,0);
+            }
+            e->n_bad++;
+            continue;
+        }
+        seq_t *s = &e->tracks[m.track].seq;
+        switch (m.type) {
+            case proto_type_NOTE: {
+                seq_event_t *tmp = acquire(e,m.track);
+                seq_event_id_t id = 0;
+                if (tmp) {
+                    *tmp = m.note;
+                    id = push_note(e,m.track,tmp,m.tick);
+                }
+                reply_bin(e,id);
+                break;
+            }
+            case proto_type_UNNOTE:
+                if (push_unnote(e,m.track,m.id) != err_NONE) {
+                    e->n_bad++;
+                }
+                break;
+            case proto_type_UPDATE: {
+                seq_event_t *tmp = acquire(e,m.track);
+                if (!tmp) {
+                    e->n_bad++;
+                } else {
+                    *tmp = m.note;
+                    if (push_update(e,m.track,m.id,tmp,m.tick) != err_NONE) {
+                        seq_event_release(s,tmp);
+                        e->n_bad++;
+                    }
+                }
+                break;
+            }
+            case proto_type_VOICES:
+                push_voices(e,m.track,m.nvoices);
+                break;
+            case proto_type_ID:
+                /* only sent, never received */
+                e->n_bad++;
+                break;
+            case proto_type_CLEAR:
+                push_clear(e,m.track);
+                break;
+            case proto_type_TEMPO:
+                push_tempo(e,m.track,m.tempo_s,
+                           m.has_tick ? m.tick : CMD_ALL_TICKS,m.ramp);
+                break;
+            case proto_type_REMOVE:
+                push_remove(e,m.track,m.tick,m.freq);
+                break;
+        }
+    }
+}
+
+/* Parses a datagram in either protocol. buf must have room for one more
+ * byte. */
+void engine_parse_dgram(engine_t *e, char *buf, size_t len)
+{
+    e->reply_len = 0;
+    e->_reply_count = 0;
+    e->_track = 0;
+    if (proto_is_bin(buf,len)) {
+        size_t n_bad = e->n_bad;
+        /* the header goes in once the number of IDs is known */
+        e->reply_len = PROTO_HDR_LEN;
+        engine_parse_bin(e,buf,len);
+        if (e->n_bad != n_bad) {
+            engine_log(e,logq_INFO,"%zu bad binary messages",e->n_bad - n_bad);
+        }
+        if (e->_reply_count) {
+            proto_put_header((uint8_t*)e->reply,ENGINE_REPLY_LEN,e->_reply_count);
+        } else {
+            e->reply_len = 0;
+        }
+    } else {
+        engine_parse_batch(e,buf,len);
+    }
+}
+
+/* Parses len bytes of newline separated messages, as many as fit in a
+ * datagram. buf is modified and must have room for one more byte. Only
+ * called by the control thread. */
+void engine_parse_batch(engine_t *e, char *buf, size_t len)
+{
+    char *end = buf + len, *nl;
+    while (buf < end) {
+        nl = memchr(buf,'\n',end - buf);
+        if (!nl) {
+            nl = end;
+        }
+        *nl = '\0';
+        if (*buf) {
+            size_t n_bad = e->n_bad;
+            engine_parse_mess(e,buf);
+            if (e->n_bad != n_bad) {
+                /* buf is now just the first word */
+                engine_log(e,logq_INFO,"bad %s message",buf);
+            }
+        }
+        buf = nl + 1;
+    }
+}
+
+/* Hands an event of track back to the control thread to be freed */
+static void return_event(engine_t *e, size_t track, seq_event_t *se)
+{
+    cmd_t c = { .type = cmd_FREE, .event = se, .track = track };
+    cmdq_push(&e->freeq,&c);
+}
+
+/* Moves the track at heap position i to where its next_time belongs */
+static void heap_fix(engine_t *e, size_t i)
+{
+    size_t *h = e->_heap, n = e->ntracks, k = h[i], j;
+    double key = e->tracks[k].next_time;
+    while ((i > 0) && (e->tracks[h[(i - 1) / 2]].next_time > key)) {
+        h[i] = h[(i - 1) / 2];
+        e->tracks[h[i]]._hpos = i;
+        i = (i - 1) / 2;
+    }
+    while ((j = 2 * i + 1) < n) {
+        if ((j + 1 < n) && (e->tracks[h[j + 1]].next_time < e->tracks[h[j]].next_time)) {
+            j++;
+        }
+        if (e->tracks[h[j]].next_time >= key) {
+            break;
+        }
+        h[i] = h[j];
+        e->tracks[h[i]]._hpos = i;
+        i = j;
+    }
+    h[i] = k;
+    e->tracks[k]._hpos = i;
+}
+
+/* Finds the track's next event after the playhead moved other than by
+ * playing, i.e. the first tick with events whose onset is after one
+ * sample before the playhead. */
+static void track_resched(engine_t *e, size_t track)
+{
+    engine_track_t *t = &e->tracks[track];
+    double lo = e->time - t->loop_start - 1;
+    track_seek(t,lo < 0 ? 0 : (size_t)floor(seq_time_tick(&t->seq,lo)) + 1);
+    heap_fix(e,t->_hpos);
+}
+
+/* Counts a command the audio thread could not apply */
+static void drop_cmd(engine_t *e, cmd_t *c, const char *why)
+{
+    cmdq_dropped(&e->cmdq);
+    engine_log(e,logq_INFO,"track %u: %s",c->track,why);
+}
+
+/* Applies the commands queued by the control thread. Only called by the
+ * audio thread. */
+static void apply_cmds(engine_t *e)
+{
+    cmd_t c;
+    seq_event_t *se;
+    double pos;
+    if (atomic_load_explicit(&e->_hold,memory_order_acquire)) {
+        /* the control thread is reading the sequences */
+        return;
+    }
+    while (cmdq_peek(&e->cmdq)) {
+        if (e->_nadopt) {
+            /* nothing goes past a pattern still to be swapped in, for any
+             * track, so a hold never sees the sequences change */
+            return;
+        }
+        cmdq_pop(&e->cmdq,&c);
+        engine_track_t *t = &e->tracks[c.track];
+        switch (c.type) {
+            case cmd_NOTE:
+                /* new events wait until the next time around, so the
+                 * track's next onset stays the same */
+                if (seq_add_event(&t->seq,c.event,c.tick) != err_NONE) {
+                    return_event(e,c.track,c.event);
+                    drop_cmd(e,&c,"note not added");
+                    continue;
+                }
+                break;
+            case cmd_CLEAR:
+                seq_clear(&t->seq);
+                c.type = cmd_FREE;
+                c.event = NULL;
+                cmdq_push(&e->freeq,&c);
+                break;
+            case cmd_TEMPO:
+                if (c.tick_len > 0) {
+                    /* keep the playhead at the same tick position */
+                    pos = seq_time_tick(&t->seq,e->time - t->loop_start);
+                    if (c.tick == CMD_ALL_TICKS) {
+                        seq_tempo_reset(&t->seq,c.tick_len);
+                    } else if (seq_tempo_set(&t->seq,c.tick,c.tick_len,c.ramp)
+                            != err_NONE) {
+                        drop_cmd(e,&c,"tempo map full");
+                        continue;
+                    }
+                    t->loop_start = e->time - seq_tick_time(&t->seq,pos);
+                    track_resched(e,c.track);
+                }
+                break;
+            case cmd_REMOVE:
+                se = seq_remove_event(&t->seq,c.tick,chk_freq,&c.freq);
+                if (!se) {
+                    drop_cmd(e,&c,"no note to remove");
+                    continue;
+                }
+                return_event(e,c.track,se);
+                break;
+            case cmd_UNLINK:
+                if (seq_unlink_event(&t->seq,c.event) != err_NONE) {
+                    drop_cmd(e,&c,"note already gone");
+                    continue;
+                }
+                return_event(e,c.track,c.event);
+                break;
+            case cmd_REPLACE:
+                if (seq_replace_event(&t->seq,c.old,c.event,c.tick) != err_NONE) {
+                    return_event(e,c.track,c.event);
+                    drop_cmd(e,&c,"note not updated");
+                    continue;
+                }
+                return_event(e,c.track,c.old);
+                /* it may have moved ahead of the next onset */
+                track_resched(e,c.track);
+                break;
+            case cmd_VOICES:
+                synth_bank_set_budget(&e->bank,c.track,c.nvoices);
+                break;
+            case cmd_ADOPT:
+                if (c.tick != CMD_NOW) {
+                    /* sched_block swaps them in when the track gets there */
+                    t->_adopt = c.lists;
+                    t->_adopt_tick = c.tick;
+                    t->_adopt_epoch = c.epoch;
+                    e->_nadopt++;
+                    track_resched(e,c.track);
+                    break;
+                }
+                /* the tempo map can change too, so as for cmd_TEMPO */
+                pos = seq_time_tick(&t->seq,e->time - t->loop_start);
+                seq_adopt(&t->seq,c.lists);
+                t->loop_start = e->time - seq_tick_time(&t->seq,pos);
+                track_resched(e,c.track);
+                cmdq_push(&e->freeq,&c);
+                break;
+            case cmd_HOLD:
+                atomic_store_explicit(&e->_hold,1,memory_order_relaxed);
+                cmdq_push(&e->freeq,&c);
+                cmdq_applied(&e->cmdq);
+                return;
+            default:
+                break;
+        }
+        cmdq_applied(&e->cmdq);
+    }
+}
+
+/* Starts voices for the events of track at tick that are due, delay
+ * samples into the block, or leaves them to shed_block if load may be
+ * shed */
+static void start_tick(engine_t *e, size_t track, size_t tick, size_t delay)
+{
+    seq_t *s = &e->tracks[track].seq;
+    seq_event_t *se;
+    for (se = seq_first_at_tick(s,tick); se; se = seq_next_event(s,se)) {
+        if (seq_event_due(s,se)) {
+            synth_vc_init_t svi = {
+                .freq = se->freq,
+                .a = se->env.a,
+                .d = se->env.d,
+                .s = se->env.s,
+                .r = se->env.r,
+                .max_amp = se->env.max_amp,
+                .sus_amp = se->env.sus_amp,
+                .curve = se->env.curve
+            };
+            if (e->shed_load && (e->_nonsets < e->_max_onsets)) {
+                e->_onsets[e->_nonsets++] = (engine_onset_t) {
+                    .svi = svi,
+                    .delay = delay,
+                    .track = track,
+                    .time = e->time + delay
+                };
+            } else {
+                synth_bank_add_group(&e->bank,&e->synthproc,&svi,delay,track);
+            }
+            seq_event_set_played(s,se);
+        }
+    }
+}
+
+/* Swaps in the pattern waiting for the track's next tick, which still
+ * starts when it was going to, with the pattern's tempo map from there */
+static void track_adopt(engine_t *e, size_t track)
+{
+    engine_track_t *t = &e->tracks[track];
+    cmd_t c = {
+        .type = cmd_ADOPT,
+        .lists = t->_adopt,
+        .epoch = t->_adopt_epoch,
+        .track = track
+    };
+    seq_adopt(&t->seq,t->_adopt);
+    t->_adopt = NULL;
+    e->_nadopt--;
+    t->loop_start = t->next_time - seq_tick_time(&t->seq,t->next_tick);
+    track_seek(t,t->next_tick);
+    /* the old lists and events go back to be freed */
+    cmdq_push(&e->freeq,&c);
+}
+
+/* Starts the ticks of every track whose first sample falls in the block of
+ * nframes samples from e->time, i.e. the ticks with onsets in
+ * (time - 1, time + nframes - 1]. Tracks are taken from the heap in onset
+ * order and only visited when they have a tick with events or come to the
+ * end of their loop, so the cost is in the events played, not in the
+ * number of tracks or ticks. */
+static void sched_block(engine_t *e, size_t nframes)
+{
+    double hi = e->time + nframes - 1;
+    engine_track_t *t;
+    while ((t = &e->tracks[e->_heap[0]])->next_time <= hi) {
+        if (t->_adopt && (t->next_tick == t->_adopt_tick)) {
+            track_adopt(e,e->_heap[0]);
+        } else if (t->next_tick < t->seq._seq_len) {
+            start_tick(e,e->_heap[0],t->next_tick,
+                       (size_t)ceil(t->next_time - e->time));
+            track_seek(t,t->next_tick + 1);
+        } else {
+            /* the rest of the block is from the start of the next time
+             * around, with every event due again */
+            seq_new_loop(&t->seq);
+            t->loop_start += t->seq.loop_time;
+            track_seek(t,0);
+        }
+        heap_fix(e,0);
+    }
+}
+
+/* Whether n voices are rendered by more than one thread */
+static int render_par(engine_t *e, size_t n)
+{
+    return (e->workers.nthreads > 1) && (n > ENGINE_PAR_MIN);
+}
+
+/* What n voices are expected to cost for nframes samples, in ns, with
+ * interpolation or without, or 0 if not known yet */
+static double render_cost(engine_t *e, size_t n, size_t nframes, int near)
+{
+    double *c = e->_vcost[render_par(e,n)];
+    double vc = near ? (c[1] ? c[1] : c[0] * ENGINE_NEAR_COST) : c[0];
+    return vc * n * nframes;
+}
+
+/* Counts a block of nframes samples of n voices that took ns to render
+ * towards what a voice costs. Blocks of a few voices are left out as what
+ * they cost is mostly what any block does. */
+static void render_cost_add(engine_t *e, size_t n, size_t nframes, uint64_t ns)
+{
+    double *c = &e->_vcost[render_par(e,n)][e->bank.nearest],
+           x = (double)ns / (n * nframes);
+    if (n < ENGINE_CHUNK) {
+        return;
+    }
+    *c = *c ? *c + (x - *c) / ENGINE_COST_AVG : x;
+}
+
+/* Starts the onsets waiting in e->_onsets, first giving up what the steps
+ * in e->shed say until the block of nframes samples, begun at t0, is
+ * expected to take at most e->shed_load of its length. Voices that are
+ * ended are the ones the bank would steal first. Onsets put off start at
+ * the beginning of a later block, or are dropped once they are
+ * ENGINE_DEFER_MAX late. Each block that sheds load is logged. */
+static void shed_block(engine_t *e, size_t nframes, uint64_t t0)
+{
+    engine_stats_t *st = &e->stats;
+    double budget = e->shed_load * nframes * 1e9 / e->sr
+                  - (double)(stats_now_ns() - t0),
+           need = render_cost(e,e->bank.nactive + e->_nonsets,nframes,0),
+           late = ENGINE_DEFER_MAX * e->sr;
+    size_t n, k, nkeep = 0, ndefer = 0, nlost = 0, nended = 0;
+    int near = 0, defer = 0;
+    /* nothing is shed until a voice's cost is known */
+    for (n = 0; (n < ENGINE_NSHED) && (need > 0) && (need > budget); n++) {
+        switch (e->shed[n]) {
+            case engine_shed_INTERP:
+                near = 1;
+                break;
+            case engine_shed_DEFER:
+                defer = 1;
+                break;
+            case engine_shed_QUIETEST:
+            case engine_shed_OLDEST: {
+                size_t nv = e->bank.nactive + (defer ? 0 : e->_nonsets);
+                size_t want = (size_t)ceil((need - budget) * nv / need);
+                nended += synth_bank_shed(&e->bank,want,
+                                          e->shed[n] == engine_shed_QUIETEST ?
+                                          synth_bank_steal_QUIETEST :
+                                          synth_bank_steal_OLDEST);
+                break;
+            }
+            default:
+                /* the end of the list */
+                n = ENGINE_NSHED;
+                continue;
+        }
+        need = render_cost(e,e->bank.nactive + (defer ? 0 : e->_nonsets),
+                           nframes,near);
+    }
+    e->bank.nearest = near;
+    for (k = 0; k < e->_nonsets; k++) {
+        engine_onset_t *o = &e->_onsets[k];
+        if (!defer) {
+            synth_bank_add_group(&e->bank,&e->synthproc,&o->svi,o->delay,o->track);
+        } else if (e->time + nframes - o->time > late) {
+            nlost++;
+        } else {
+            /* those put off before were counted then */
+            ndefer += o->time >= e->time;
+            o->delay = 0;
+            e->_onsets[nkeep++] = *o;
+        }
+    }
+    e->_nonsets = nkeep;
+    if (near || defer || nended) {
+        stats_inc(&st->n_shed,1);
+        stats_inc(&st->n_shed_near,near);
+        stats_inc(&st->n_deferred,ndefer);
+        stats_inc(&st->n_deferred_lost,nlost);
+        stats_inc(&st->n_shed_voices,nended);
+        engine_log(e,logq_WARN,
+                   "shed at %llu ms:%s onsets put off %zu dropped %zu, "
+                   "voices ended %zu, need %lld us of %lld",
+                   (unsigned long long)(e->time * 1000 / e->sr),
+                   near ? " uninterpolated," : "",
+                   ndefer,nlost,nended,(long long)(need * 1e-3),
+                   (long long)(budget * 1e-3));
+    }
+}
+
+/* Renders this worker's share of the voices into its own buffer, or
+ * straight to the output for the caller. Chunks are dealt out in turn so
+ * the split, and so the output, is the same every time. */
+static void render_part(void *arg, size_t worker)
+{
+    engine_t *e = arg;
+    size_t c, first, last,
+           nthreads = e->workers.nthreads;
+    f64_t *buf = worker ? e->_mix + worker * e->_mix_stride : e->_out;
+    if (worker * ENGINE_CHUNK >= e->bank.nactive) {
+        /* no voices for this one, its buffer isn't mixed in */
+        return;
+    }
+    if (worker) {
+        _MZ(buf,f64_t,e->_nframes);
+    }
+    for (c = worker; (first = c * ENGINE_CHUNK) < e->bank.nactive; c += nthreads) {
+        last = first + ENGINE_CHUNK;
+        synth_bank_proc_range(&e->bank,&e->synthproc,&e->_scratch[worker],
+                              buf,e->_nframes,first,
+                              last < e->bank.nactive ? last : e->bank.nactive);
+    }
+}
+
+/* Mixes the voices into out, which has been zeroed */
+static void render(engine_t *e, f64_t *out, size_t nframes)
+{
+    size_t n, t, k,
+           nbusy = (e->bank.nactive + ENGINE_CHUNK - 1) / ENGINE_CHUNK;
+    if (!render_par(e,e->bank.nactive)) {
+        /* waking the other threads would cost more than it saves */
+        synth_bank_proc(&e->bank,&e->synthproc,out,nframes);
+        return;
+    }
+    if (nbusy > e->workers.nthreads) {
+        nbusy = e->workers.nthreads;
+    }
+    for (; nframes; nframes -= k, out += k) {
+        k = nframes < e->_mix_stride ? nframes : e->_mix_stride;
+        e->_out = out;
+        e->_nframes = k;
+        workers_run(&e->workers,render_part,e);
+        for (t = 1; t < nbusy; t++) {
+            f64_t *buf = e->_mix + t * e->_mix_stride;
+            for (n = 0; n < k; n++) {
+                out[n] += buf[n];
+            }
+        }
+    }
+    synth_bank_reap(&e->bank,&e->synthproc);
+}
+
+/* Notes how long a block of nframes took, from t0 to t2 with the notes
+ * started by t1 */
+static void stats_block(engine_t *e, size_t nframes,
+                        uint64_t t0, uint64_t t1, uint64_t t2)
+{
+    engine_stats_t *st = &e->stats;
+    double budget_ns = nframes * 1e9 / e->sr;
+    stats_hist_add(&st->proc_ns,t2 - t0);
+    stats_hist_add(&st->sched_ns,t1 - t0);
+    stats_hist_add(&st->render_ns,t2 - t1);
+    stats_hist_add(&st->load,(uint64_t)((t2 - t0) * 10000 / budget_ns));
+    stats_hist_add(&st->voices,e->bank.nactive);
+    stats_inc(&st->n_blocks,1);
+    if (t2 - t0 > budget_ns) {
+        stats_inc(&st->n_late,1);
+    }
+    stats_set(&st->n_notes_dropped,e->bank.n_dropped);
+    stats_set(&st->n_stolen,e->bank.n_stolen);
+    stats_set(&st->n_retrig,e->bank.n_retrig);
+    stats_set(&st->n_culled,e->bank.n_culled);
+    stats_set(&st->n_culled_samps,e->bank.n_culled_samps);
+    if (e->silent) {
+        stats_inc(&st->n_silent,1);
+    }
+}
+
+/* Renders nframes samples to out, and sets e->silent if they are all 0
+ * because no voice was playing. Only called by the audio thread. */
+void engine_proc(engine_t *e, f64_t *out, size_t nframes)
+{
+    uint64_t t0 = stats_now_ns(), t1, t2;
+    size_t nvoices;
+    /* commands are only applied here so the audio thread never waits */
+    apply_cmds(e);
+    sched_block(e,nframes);
+    if (e->shed_load) {
+        shed_block(e,nframes,t0);
+    }
+    e->time += nframes;
+    t1 = stats_now_ns();
+    _MZ(out,f64_t,nframes);
+    nvoices = e->bank.nactive;
+    e->silent = nvoices == 0;
+    if (!e->silent) {
+        render(e,out,nframes);
+    }
+    t2 = stats_now_ns();
+    if (!e->silent) {
+        render_cost_add(e,nvoices,nframes,t2 - t1);
+    }
+    stats_block(e,nframes,t0,t1,t2);
+}
+
+/* Counts an xrun. Can be called from any thread. */
+void engine_xrun(engine_t *e)
+{
+    atomic_fetch_add_explicit(&e->stats.n_xruns,1,memory_order_relaxed);
+}
+
+static size_t put_hist(char *buf, size_t len, const char *name,
+                       stats_hist_t *h, double scale)
+{
+    int n = snprintf(buf,len,"%s: mean %.1f p50 %.1f p99 %.1f max %.1f\n",name,
+                     stats_hist_mean(h) * scale,
+                     stats_hist_quantile(h,0.5) * scale,
+                     stats_hist_quantile(h,0.99) * scale,
+                     stats_get(&h->max) * scale);
+    return n < 0 ? 0 : ((size_t)n < len ? (size_t)n : len - 1);
+}
+
+/* Writes the stats as text lines to buf, which has room for len bytes
+ * including a terminating nul, and returns the number written without it.
+ * Times are in microseconds and quantiles are the bottom of the bucket they
+ * fall in. Can be called from any thread. */
+size_t engine_stats_str(engine_t *e, char *buf, size_t len)
+{
+    engine_stats_t *st = &e->stats;
+    size_t n = 0, n_applied, n_dropped, n_logged, n_log_dropped;
+    int k;
+    if (len == 0) {
+        return 0;
+    }
+    cmdq_stats(&e->cmdq,&n_applied,&n_dropped);
+    logq_stats(&e->log,&n_logged,&n_log_dropped);
+    k = snprintf(buf,len,"blocks %llu late %llu xruns %llu\n",
+                 (unsigned long long)stats_get(&st->n_blocks),
+                 (unsigned long long)stats_get(&st->n_late),
+                 (unsigned long long)stats_get(&st->n_xruns));
+    n += k < 0 ? 0 : ((size_t)k < len ? (size_t)k : len - 1);
+    n += put_hist(buf + n,len - n,"block us",&st->proc_ns,1e-3);
+    n += put_hist(buf + n,len - n,"sched us",&st->sched_ns,1e-3);
+    n += put_hist(buf + n,len - n,"render us",&st->render_ns,1e-3);
+    n += put_hist(buf + n,len - n,"load %",&st->load,0.01);
+    n += put_hist(buf + n,len - n,"voices",&st->voices,1);
+    k = snprintf(buf + n,len - n,
+                 "notes dropped %llu stolen %llu retriggered %llu\n"
+                 "voices culled %llu samples %llu silent blocks %llu\n"
+                 "shed blocks %llu uninterpolated %llu onsets put off %llu "
+                 "dropped %llu voices ended %llu\n"
+                 "commands applied %zu dropped %zu\n"
+                 "log messages %zu dropped %zu\n"
+                 "memory %zu bytes%s\n",
+                 (unsigned long long)stats_get(&st->n_notes_dropped),
+                 (unsigned long long)stats_get(&st->n_stolen),
+                 (unsigned long long)stats_get(&st->n_retrig),
+                 (unsigned long long)stats_get(&st->n_culled),
+                 (unsigned long long)stats_get(&st->n_culled_samps),
+                 (unsigned long long)stats_get(&st->n_silent),
+                 (unsigned long long)stats_get(&st->n_shed),
+                 (unsigned long long)stats_get(&st->n_shed_near),
+                 (unsigned long long)stats_get(&st->n_deferred),
+                 (unsigned long long)stats_get(&st->n_deferred_lost),
+                 (unsigned long long)stats_get(&st->n_shed_voices),
+                 n_applied,n_dropped,n_logged,n_log_dropped,
+                 e->arena.size,e->arena.locked ? " locked" : "");
+    n += k < 0 ? 0 : ((size_t)k < len - n ? (size_t)k : len - n - 1);
+    return n;
+}
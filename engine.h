@@ -0,0 +1,248 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "seq.h"
+#include "synth.h"
+#include "synth_bank.h"
+#include "cmdq.h"
+#include "proto.h"
+#include "workers.h"
+#include "logq.h"
+#include "stats.h"
+#include "snap.h"
+#include "arena.h"
+
+/* Voices are split over the render threads in chunks of this many, and
+ * are only rendered in parallel when there are more than ENGINE_PAR_MIN */
+#define ENGINE_CHUNK SYNTH_BANK_MAX_LANES
+#define ENGINE_PAR_MIN (4 * ENGINE_CHUNK)
+
+/* Longest path a snapshot can be saved to */
+#define ENGINE_PATH_LEN 256
+
+/* Longest reply to a datagram, which has at most one id per note in it, or
+ * the stats */
+#define ENGINE_REPLY_LEN 1472
+
+/* Most steps in the order load is shed in */
+#define ENGINE_NSHED 4
+/* The cost of a voice is averaged over about this many blocks */
+#define ENGINE_COST_AVG 16
+/* What a voice is assumed to cost without interpolation, as a share of
+ * what it costs with, until it has been measured */
+#define ENGINE_NEAR_COST 0.9
+/* Onsets are put off for at most this long, in seconds, then dropped */
+#define ENGINE_DEFER_MAX 0.05
+
+/* What the audio thread gives up when a block would take longer than
+ * engine_init_t.shed_load of its length to render */
+typedef enum engine_shed_t {
+    engine_shed_NONE,
+    engine_shed_INTERP,   /* render without interpolation */
+    engine_shed_DEFER,    /* put the block's onsets off to a later block */
+    engine_shed_QUIETEST, /* end the quietest voices */
+    engine_shed_OLDEST,   /* end the oldest voices */
+    engine_NSHED_KINDS
+} engine_shed_t;
+
+/* A voice to start, put off while shedding load */
+typedef struct engine_onset_t {
+    synth_vc_init_t svi;
+    size_t delay;  /* into the block */
+    size_t track;
+    double time;   /* engine time it was due at */
+} engine_onset_t;
+
+/* The sequencer, its voices and the command queues feeding them. Messages
+ * are parsed on a control thread with engine_parse_mess, and engine_proc
+ * renders a block on the audio thread (or in a loop when rendering
+ * offline), with help from nthreads - 1 render threads if asked for. An
+ * engine must not move once initialized. */
+
+/* A track is a sequence with its own length, tempo and share of the
+ * voices. Tracks play side by side in one engine. */
+typedef struct engine_track_init_t {
+    size_t seq_len;    /* in ticks */
+    f64_t tick_len;    /* in seconds */
+    size_t max_events; /* in the sequence at once */
+    size_t nvoices;    /* most voices it plays at once */
+} engine_track_init_t;
+
+typedef struct engine_init_t {
+    f64_t sr;               /* sample rate */
+    size_t nvoices;
+    size_t seq_len;         /* in ticks */
+    size_t max_events;      /* in the sequence at once, over all ticks */
+    f64_t tick_len;         /* in seconds */
+    size_t wavetable_len;   /* of the lowest octave's table */
+    size_t wavetable_nharm; /* most harmonics in any table */
+    size_t cmdq_size;
+    synth_bank_isa_t isa;
+    synth_bank_steal_t steal; /* what to do when all voices are playing */
+    synth_bank_phase_t phase; /* FIXED needs a power of 2 wavetable_len */
+    f64_t cull_db;            /* voices that stay below this gain are ended */
+    size_t nthreads;          /* to render voices with, including the caller */
+    int rt_prio;              /* of the other render threads, 0 to not ask */
+    size_t max_block;         /* longest mix per render, longer blocks are split */
+    /* The share of a block's length the engine may take to make it, 0 to
+     * never shed load, and what to give up, in order, until a block is
+     * expected to fit. The steps after the first engine_shed_NONE are
+     * ignored. */
+    f64_t shed_load;
+    engine_shed_t shed[ENGINE_NSHED];
+    size_t ntracks;
+    /* ntracks settings, or NULL for each to get seq_len, tick_len,
+     * max_events and nvoices above */
+    const engine_track_init_t *tracks;
+    size_t log_size;          /* messages waiting to be written at once */
+    logq_level_t log_level;   /* most verbose kept, changed with "log" */
+    FILE *log_out;            /* where log messages go, NULL for nowhere */
+    /* The directory "save" and "load" paths are taken relative to, or
+     * empty to refuse both. Anyone who can send the engine a message can
+     * write or read a snapshot anywhere under it, including through any
+     * symbolic link in it, so it should hold nothing else. */
+    char snap_dir[ENGINE_PATH_LEN];
+} engine_init_t;
+
+#define ENGINE_INIT_DEFAULT (engine_init_t) { \
+    .sr = 48000, \
+    .nvoices = 10, \
+    .seq_len = 16, \
+    .max_events = 1024, \
+    .tick_len = 1., \
+    .wavetable_len = 4096, \
+    .wavetable_nharm = 10, \
+    .cmdq_size = 1024, \
+    .isa = synth_bank_isa_AUTO, \
+    .steal = synth_bank_steal_OLDEST, \
+    .phase = synth_bank_phase_FLOAT, \
+    .cull_db = -100, \
+    .nthreads = 1, \
+    .rt_prio = 0, \
+    .max_block = 4096, \
+    .shed_load = 0, \
+    .shed = { engine_shed_INTERP, engine_shed_DEFER, engine_shed_QUIETEST }, \
+    .ntracks = 1, \
+    .tracks = NULL, \
+    .log_size = 256, \
+    .log_level = logq_WARN, \
+    .log_out = NULL, \
+    .snap_dir = "" \
+}
+
+typedef struct engine_track_t {
+    seq_t seq;
+    double loop_start;   /* engine time the current loop started at */
+    /* The next tick with events, or seq_len for the end of the loop, and
+     * the engine time it starts at. Tracks are kept in a heap on it. */
+    size_t next_tick;
+    double next_time;
+    size_t _hpos;
+    size_t nvoices;      /* budget last asked for, kept by the control thread */
+    /* A committed pattern to swap in when the track next reaches
+     * _adopt_tick, kept by the audio thread, and the epoch of its events */
+    seq_lists_t *_adopt;
+    size_t _adopt_tick;
+    uint32_t _adopt_epoch;
+    /* The pattern being staged, or NULL, and the epoch before staging
+     * began, kept by the control thread */
+    seq_lists_t *stage;
+    uint32_t _stage_prev_epoch;
+} engine_track_t;
+
+/* How the audio thread is keeping up, written by it once per block and
+ * readable from any thread */
+typedef struct engine_stats_t {
+    stats_hist_t proc_ns;   /* in engine_proc */
+    stats_hist_t sched_ns;  /* applying commands and starting notes */
+    stats_hist_t render_ns; /* mixing the voices */
+    stats_hist_t load;      /* time in engine_proc per 10000 of the block's */
+    stats_hist_t voices;    /* playing at the end of a block */
+    _Atomic uint64_t n_blocks;
+    _Atomic uint64_t n_late;  /* blocks that took longer to make than play */
+    _Atomic uint64_t n_xruns; /* reported with engine_xrun */
+    /* copied from the bank */
+    _Atomic uint64_t n_notes_dropped;
+    _Atomic uint64_t n_stolen;
+    _Atomic uint64_t n_retrig;
+    _Atomic uint64_t n_culled;
+    _Atomic uint64_t n_culled_samps;
+    _Atomic uint64_t n_silent; /* blocks with no voices, so not rendered */
+    /* blocks that shed load, and of those, the ones rendered without
+     * interpolation, then onsets put off, onsets dropped after being put
+     * off too long and voices ended */
+    _Atomic uint64_t n_shed;
+    _Atomic uint64_t n_shed_near;
+    _Atomic uint64_t n_deferred;
+    _Atomic uint64_t n_deferred_lost;
+    _Atomic uint64_t n_shed_voices;
+} engine_stats_t;
+
+typedef struct engine_t {
+    arena_t arena;       /* everything below that isn't in the struct */
+    engine_track_t *tracks;
+    size_t ntracks;
+    size_t _nadopt;      /* tracks with a pattern waiting to be swapped in */
+    size_t *_heap;       /* track indices, soonest next_time first */
+    synth_bank_t bank;
+    wtset_t wtset;
+    synth_vc_proc_t synthproc;
+    /* Commands from the control thread to the audio thread, and events the
+     * audio thread no longer references going back to be freed */
+    cmdq_t cmdq;
+    cmdq_t freeq;
+    f64_t sr;
+    double time;         /* samples rendered */
+    /* Render threads, a scratch area and a mix buffer each. The buffers
+     * are summed into the output once all have finished. */
+    workers_t workers;
+    synth_bank_scratch_t *_scratch;
+    f64_t *_mix;
+    size_t _mix_stride;
+    f64_t *_out;         /* being rendered to */
+    size_t _nframes;
+    /* The IDs of the notes in the last datagram parsed, as text lines or a
+     * binary datagram to match it, to be sent back to the client. Empty
+     * if there were no notes. */
+    char reply[ENGINE_REPLY_LEN];
+    size_t reply_len;
+    size_t _reply_count;
+    size_t _track;     /* text messages are for this track */
+    logq_t log;        /* written by both threads */
+    /* set by the audio thread when it stops applying commands so a snapshot
+     * can be saved, and cleared by the control thread once it is */
+    _Atomic int _hold;
+    char _save_path[ENGINE_PATH_LEN]; /* empty if no save is waiting */
+    char _snap_dir[ENGINE_PATH_LEN];  /* see engine_init_t.snap_dir */
+    engine_stats_t stats;
+    /* Load shedding. The cost of a voice for a sample in ns, rendered on
+     * one thread or several, with interpolation or without, as measured
+     * over recent blocks, or 0 if not yet known. */
+    f64_t shed_load;
+    engine_shed_t shed[ENGINE_NSHED];
+    double _vcost[2][2];
+    /* onsets due this block, or put off from earlier ones, waiting for
+     * shed_block to start them */
+    engine_onset_t *_onsets;
+    size_t _nonsets;
+    size_t _max_onsets;
+    int silent;        /* the last block had no voices and is all 0 */
+    volatile int quit; /* set when a quit message is parsed */
+    size_t n_bad;      /* messages that could not be parsed */
+} engine_t;
+
+err_t engine_init(engine_t *e, engine_init_t *ei);
+void engine_destroy(engine_t *e);
+void engine_parse_mess(engine_t *e, char *buf);
+void engine_parse_batch(engine_t *e, char *buf, size_t len);
+void engine_parse_bin(engine_t *e, const void *buf, size_t len);
+void engine_parse_dgram(engine_t *e, char *buf, size_t len);
+void engine_free_returned(engine_t *e);
+void engine_proc(engine_t *e, f64_t *out, size_t nframes);
+void engine_xrun(engine_t *e);
+size_t engine_stats_str(engine_t *e, char *buf, size_t len);
+
+#endif /* ENGINE_H */
@@ -0,0 +1,178 @@
+/* Segment based ADSR envelope */
+#include "env.h"
+#include <math.h>
+#include <stdint.h>
+
+err_t env_init(env_t *e,
+               f64_t a,
+               f64_t d,
+               f64_t s,
+               f64_t r,
+               f64_t max_amp,
+               f64_t sus_amp,
+               env_curve_t curve)
+{
+    if ((a < 0) || (d < 0) || (s < 0) || (r < 0)) {
+        return err_EINVAL;
+    }
+    if ((curve != env_curve_LIN) && (curve != env_curve_EXP)) {
+        return err_EINVAL;
+    }
+    _MZ(e,env_t,1);
+    e->a = a;
+    e->d = d;
+    e->s = s;
+    e->r = r;
+    e->max_amp = max_amp;
+    e->sus_amp = sus_amp;
+    e->curve = curve;
+    e->_a_rcp = a > 0 ? 1./a : 0;
+    e->_d_rcp = d > 0 ? 1./d : 0;
+    e->_r_rcp = r > 0 ? 1./r : 0;
+    e->_seg = env_seg_IDLE;
+    e->_inc = curve == env_curve_EXP ? 1. : 0.;
+    return err_NONE;
+}
+
+/* Holds the gain at 0 for nsamps samples before the attack starts. Only
+ * valid before the first env_proc. */
+void env_delay(env_t *e, size_t nsamps)
+{
+    e->_rem = nsamps;
+}
+
+/* Stops the envelope, its gain is 0 from now on. */
+void env_end(env_t *e)
+{
+    e->_seg = env_seg_END;
+    e->_lvl = 0;
+    e->_inc = e->curve == env_curve_EXP ? 1. : 0.;
+    e->_rem = SIZE_MAX;
+}
+
+/* Per-sample multiplier taking a level to ratio times itself over a segment
+ * whose reciprocal length is rcp. */
+static inline f64_t exp_step(f64_t ratio, f64_t rcp, f64_t t_s)
+{
+    if (ratio <= 0) {
+        return 1.;
+    }
+    return expf(logf(ratio) * rcp * t_s);
+}
+
+static void seg_enter(env_t *e, env_seg_t seg, f64_t sr)
+{
+    int lin = e->curve == env_curve_LIN;
+    f64_t t_s = 1./sr;
+    e->_seg = seg;
+    switch (seg) {
+        case env_seg_ATK:
+            e->_rem = (size_t)(e->a * sr + 0.5);
+            if (lin) {
+                e->_lvl = 0;
+                e->_inc = e->max_amp * e->_a_rcp * t_s;
+            } else {
+                e->_lvl = e->max_amp * ENV_EXP_FLOOR;
+                e->_inc = exp_step(1./ENV_EXP_FLOOR,e->_a_rcp,t_s);
+            }
+            break;
+        case env_seg_DEC:
+            e->_rem = (size_t)(e->d * sr + 0.5);
+            e->_lvl = e->max_amp;
+            if (lin) {
+                e->_inc = (e->sus_amp - e->max_amp) * e->_d_rcp * t_s;
+            } else {
+                f64_t tgt = e->sus_amp > e->max_amp * ENV_EXP_FLOOR ?
+                    e->sus_amp : e->max_amp * ENV_EXP_FLOOR;
+                e->_inc = e->max_amp > 0 ?
+                    exp_step(tgt / e->max_amp,e->_d_rcp,t_s) : 1.;
+            }
+            break;
+        case env_seg_SUS:
+            e->_rem = (size_t)(e->s * sr + 0.5);
+            e->_lvl = e->sus_amp;
+            e->_inc = lin ? 0. : 1.;
+            break;
+        case env_seg_REL:
+            e->_rem = (size_t)(e->r * sr + 0.5);
+            e->_lvl = e->sus_amp;
+            if (lin) {
+                e->_inc = -e->sus_amp * e->_r_rcp * t_s;
+            } else {
+                e->_inc = exp_step(ENV_EXP_FLOOR,e->_r_rcp,t_s);
+            }
+            break;
+        default:
+            env_end(e);
+            break;
+    }
+}
+
+/* Writes nsamps gains to gain, stride apart, advancing the envelope. Once
+ * the release has finished the envelope is done and the gains are 0. */
+void env_proc(env_t *e, f64_t sr, f64_t *gain, size_t stride, size_t nsamps)
+{
+    while (nsamps) {
+        if (e->_rem == 0) {
+            seg_enter(e,e->_seg + 1,sr);
+            continue;
+        }
+        size_t n, k = e->_rem < nsamps ? e->_rem : nsamps;
+        f64_t lvl = e->_lvl, inc = e->_inc;
+        if (e->curve == env_curve_LIN) {
+            for (n = 0; n < k; n++) {
+                *gain = lvl;
+                lvl += inc;
+                gain += stride;
+            }
+        } else {
+            for (n = 0; n < k; n++) {
+                *gain = lvl;
+                lvl *= inc;
+                gain += stride;
+            }
+        }
+        e->_lvl = lvl;
+        if (e->_seg != env_seg_END) {
+            e->_rem -= k;
+        }
+        nsamps -= k;
+    }
+}
+
+/* The largest gain, ignoring sign, the envelope can still give. Every
+ * segment heads straight for its end level, so this is the larger of where
+ * it is and where it is going, and a release only falls. */
+f64_t env_peak(const env_t *e)
+{
+    f64_t lvl = fabsf(e->_lvl),
+          max_amp = fabsf(e->max_amp),
+          sus_amp = fabsf(e->sus_amp);
+    switch (e->_seg) {
+        case env_seg_IDLE:
+        case env_seg_ATK:
+            return max_amp > sus_amp ? max_amp : sus_amp;
+        case env_seg_DEC:
+            return lvl > sus_amp ? lvl : sus_amp;
+        case env_seg_SUS:
+        case env_seg_REL:
+            return lvl;
+        default:
+            return 0;
+    }
+}
+
+/* Samples until the envelope is done */
+size_t env_left(const env_t *e, f64_t sr)
+{
+    f64_t segs[] = { e->a, e->d, e->s, e->r };
+    size_t n, left;
+    if (e->_seg == env_seg_END) {
+        return 0;
+    }
+    left = e->_rem;
+    for (n = e->_seg; n < sizeof(segs)/sizeof(segs[0]); n++) {
+        left += (size_t)(segs[n] * sr + 0.5);
+    }
+    return left;
+}
@@ -0,0 +1,63 @@
+#ifndef ENV_H
+#define ENV_H
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+
+/* Segment based ADSR envelope. The current segment and its per-sample step
+ * are kept so that the gain is one add (linear) or one multiply
+ * (exponential) per sample; segments only change at their boundaries. */
+
+/* Level relative to the segment's peak at which exponential segments are
+ * considered to have reached 0 (-60 dB) */
+#define ENV_EXP_FLOOR 0.001
+
+typedef enum env_curve_t {
+    env_curve_LIN,
+    env_curve_EXP
+} env_curve_t;
+
+typedef enum env_seg_t {
+    env_seg_IDLE, /* not yet started, 0 gain for any delay */
+    env_seg_ATK,
+    env_seg_DEC,
+    env_seg_SUS,
+    env_seg_REL,
+    env_seg_END
+} env_seg_t;
+
+typedef struct env_t {
+    f64_t a;
+    f64_t d;
+    f64_t s;
+    f64_t r;
+    f64_t max_amp; /* maximum amplitude */
+    f64_t sus_amp; /* sustain amplitude */
+    env_curve_t curve;
+    f64_t _a_rcp;  /* reciprocals of a, d and r, 0 if the segment is empty */
+    f64_t _d_rcp;
+    f64_t _r_rcp;
+    env_seg_t _seg;
+    f64_t _lvl;    /* gain of the next sample */
+    f64_t _inc;    /* added (LIN) or multiplied (EXP) each sample */
+    size_t _rem;   /* samples left in the current segment */
+} env_t;
+
+#define env_done(e) ((e)->_seg == env_seg_END)
+
+err_t env_init(env_t *e,
+               f64_t a,
+               f64_t d,
+               f64_t s,
+               f64_t r,
+               f64_t max_amp,
+               f64_t sus_amp,
+               env_curve_t curve);
+void env_delay(env_t *e, size_t nsamps);
+void env_end(env_t *e);
+void env_proc(env_t *e, f64_t sr, f64_t *gain, size_t stride, size_t nsamps);
+f64_t env_peak(const env_t *e);
+size_t env_left(const env_t *e, f64_t sr);
+
+#endif /* ENV_H */
@@ -0,0 +1,199 @@
+/* Multi-producer/single-consumer log ring */
+#include "logq.h"
+#include <stdarg.h>
+#include <stdint.h>
+#include <time.h>
+
+static const char *level_strs[logq_NLEVELS] = {
+    "error", "warn", "info", "debug"
+};
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *drain_main(void *arg)
+{
+    logq_t *q = arg;
+    struct timespec ts = {
+        .tv_sec = q->period_us / 1000000,
+        .tv_nsec = (q->period_us % 1000000) * 1000
+    };
+    while (!atomic_load(&q->_quit)) {
+        logq_drain(q,q->out);
+        nanosleep(&ts,NULL);
+    }
+    return NULL;
+}
+
+static size_t round_size(size_t size)
+{
+    size_t sz = 1;
+    while (sz < size) {
+        sz <<= 1;
+    }
+    return sz;
+}
+
+size_t logq_mem_size(size_t size)
+{
+    return arena_size(round_size(size) * sizeof(logq_rec_t));
+}
+
+/* Starts the drain thread if li->out is set. It runs at normal priority,
+ * below any realtime threads. Takes logq_mem_size(li->size) bytes from
+ * li->arena. */
+err_t logq_init(logq_t *q, logq_init_t *li)
+{
+    size_t sz = round_size(li->size), n;
+    _MZ(q,logq_t,1);
+    if ((li->size == 0) || (li->level >= logq_NLEVELS)) {
+        return err_EINVAL;
+    }
+    q->_arena = li->arena;
+    q->recs = arena_alloc(li->arena,sz * sizeof(logq_rec_t));
+    if (!q->recs) {
+        return err_MEM;
+    }
+    for (n = 0; n < sz; n++) {
+        atomic_init(&q->recs[n].seq,n);
+    }
+    q->size = sz;
+    atomic_init(&q->level,li->level);
+    atomic_init(&q->tail,0);
+    atomic_init(&q->_quit,0);
+    for (n = 0; n < logq_NLEVELS; n++) {
+        atomic_init(&q->n_logged[n],0);
+        atomic_init(&q->n_dropped[n],0);
+    }
+    q->_t0 = now();
+    q->out = li->out;
+    q->period_us = li->period_us;
+    if (q->out) {
+        if (pthread_create(&q->_thread,NULL,drain_main,q) != 0) {
+            logq_destroy(q);
+            return err_MEM;
+        }
+        q->_started = 1;
+    }
+    return err_NONE;
+}
+
+/* Stops the drain thread and writes out what is left. No thread may log
+ * to it any more. */
+void logq_destroy(logq_t *q)
+{
+    if (q->_started) {
+        atomic_store(&q->_quit,1);
+        pthread_join(q->_thread,NULL);
+        logq_drain(q,q->out);
+    }
+    arena_free(q->_arena,q->recs);
+    _MZ(q,logq_t,1);
+}
+
+/* Can be called by any thread. Returns err_FULL, and counts the message as
+ * dropped, if no record could be had. */
+err_t logq_write(logq_t *q, logq_level_t level, const char *fmt, ...)
+{
+    size_t pos = atomic_load_explicit(&q->tail,memory_order_relaxed),
+           tries;
+    logq_rec_t *r;
+    for (tries = 0; tries < LOGQ_RETRIES; tries++) {
+        r = &q->recs[pos & (q->size - 1)];
+        intptr_t dif = (intptr_t)atomic_load_explicit(&r->seq,memory_order_acquire)
+            - (intptr_t)pos;
+        if (dif < 0) {
+            /* the consumer hasn't read this one yet */
+            break;
+        }
+        if (dif > 0) {
+            /* another producer took it */
+            pos = atomic_load_explicit(&q->tail,memory_order_relaxed);
+        } else if (atomic_compare_exchange_weak_explicit(&q->tail,&pos,pos + 1,
+                       memory_order_relaxed,memory_order_relaxed)) {
+            va_list ap;
+            r->level = level;
+            r->time = now() - q->_t0;
+            va_start(ap,fmt);
+            vsnprintf(r->msg,LOGQ_MSG_LEN,fmt,ap);
+            va_end(ap);
+            atomic_store_explicit(&r->seq,pos + 1,memory_order_release);
+            atomic_fetch_add_explicit(&q->n_logged[level],1,memory_order_relaxed);
+            return err_NONE;
+        }
+    }
+    atomic_fetch_add_explicit(&q->n_dropped[level],1,memory_order_relaxed);
+    return err_FULL;
+}
+
+/* Writes the messages that are ready to out, or throws them away if it is
+ * NULL, and notes any dropped since last time. Only called by the drain
+ * thread, or by the one thread that logs if there is none. Returns the
+ * number of messages taken. */
+size_t logq_drain(logq_t *q, FILE *out)
+{
+    size_t n = 0, nlogged, ndropped;
+    for (;; n++) {
+        logq_rec_t *r = &q->recs[q->head & (q->size - 1)];
+        if (atomic_load_explicit(&r->seq,memory_order_acquire) != q->head + 1) {
+            /* empty, or the next one is still being written */
+            break;
+        }
+        if (out) {
+            fprintf(out,"%10.3f %s: %s\n",r->time,level_strs[r->level],r->msg);
+        }
+        atomic_store_explicit(&r->seq,q->head + q->size,memory_order_release);
+        q->head++;
+    }
+    logq_stats(q,&nlogged,&ndropped);
+    if (ndropped != q->_ndropped_seen) {
+        if (out) {
+            fprintf(out,"log: %zu messages dropped\n",ndropped - q->_ndropped_seen);
+        }
+        q->_ndropped_seen = ndropped;
+    }
+    if (out && n) {
+        fflush(out);
+    }
+    return n;
+}
+
+/* Messages more verbose than level are thrown away before being
+ * formatted */
+void logq_set_level(logq_t *q, logq_level_t level)
+{
+    atomic_store_explicit(&q->level,level,memory_order_relaxed);
+}
+
+err_t logq_level_from_str(logq_level_t *level, const char *str)
+{
+    int n;
+    for (n = 0; n < logq_NLEVELS; n++) {
+        if (strcmp(str,level_strs[n]) == 0) {
+            *level = n;
+            return err_NONE;
+        }
+    }
+    return err_NFND;
+}
+
+const char *logq_level_str(logq_level_t level)
+{
+    return level < logq_NLEVELS ? level_strs[level] : "?";
+}
+
+/* Totals over all levels */
+void logq_stats(logq_t *q, size_t *n_logged, size_t *n_dropped)
+{
+    size_t n;
+    *n_logged = 0;
+    *n_dropped = 0;
+    for (n = 0; n < logq_NLEVELS; n++) {
+        *n_logged += atomic_load_explicit(&q->n_logged[n],memory_order_relaxed);
+        *n_dropped += atomic_load_explicit(&q->n_dropped[n],memory_order_relaxed);
+    }
+}
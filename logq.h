@@ -0,0 +1,98 @@
+#ifndef LOGQ_H
+#define LOGQ_H
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "arena.h"
+
+/* Lock-free multi-producer/single-consumer ring of log messages. Any
+ * thread, the audio thread included, formats a message straight into a
+ * free record and a low priority thread writes them out, so logging never
+ * waits on I/O or a lock. A producer gives up after LOGQ_RETRIES lost
+ * races or if the ring is full, and the message is counted as dropped.
+ * Messages are formatted with vsnprintf, which doesn't allocate or lock
+ * for integer and string conversions, so those are all the audio thread
+ * should use. */
+
+#define LOGQ_CACHE_LINE 64
+#define LOGQ_RETRIES 8
+#define LOGQ_MSG_LEN 104 /* so a record fills two cache lines */
+
+typedef enum logq_level_t {
+    logq_ERROR,
+    logq_WARN,
+    logq_INFO,
+    logq_DEBUG,
+    logq_NLEVELS
+} logq_level_t;
+
+typedef struct logq_rec_t {
+    _Atomic size_t seq; /* position it can be written at, or + 1 once it
+                           can be read */
+    logq_level_t level;
+    double time;        /* seconds since the ring was made */
+    char msg[LOGQ_MSG_LEN];
+} __attribute__((aligned(LOGQ_CACHE_LINE))) logq_rec_t;
+
+typedef struct logq_init_t {
+    size_t size;        /* records, rounded up to a power of 2 */
+    logq_level_t level; /* most verbose level kept */
+    FILE *out;          /* written to by the drain thread, NULL for none */
+    size_t period_us;   /* between drains */
+    arena_t *arena;     /* for the ring, NULL for the heap */
+} logq_init_t;
+
+#define LOGQ_INIT_DEFAULT (logq_init_t) { \
+    .size = 256, \
+    .level = logq_WARN, \
+    .out = NULL, \
+    .period_us = 10000, \
+    .arena = NULL \
+}
+
+/* The drain thread keeps a pointer to this so it must not move once
+ * initialized */
+typedef struct logq_t {
+    logq_rec_t *recs;
+    size_t size;
+    _Atomic int level;
+    double _t0;
+    /* claimed by producers */
+    _Atomic size_t tail __attribute__((aligned(LOGQ_CACHE_LINE)));
+    /* only touched by the consumer */
+    size_t head __attribute__((aligned(LOGQ_CACHE_LINE)));
+    size_t _ndropped_seen;
+    FILE *out;
+    size_t period_us;
+    pthread_t _thread;
+    int _started;
+    _Atomic int _quit;
+    /* messages written to the ring, and lost, by level */
+    _Atomic size_t n_logged[logq_NLEVELS] __attribute__((aligned(LOGQ_CACHE_LINE)));
+    _Atomic size_t n_dropped[logq_NLEVELS];
+    arena_t *_arena;
+} logq_t;
+
+err_t logq_init(logq_t *q, logq_init_t *li);
+size_t logq_mem_size(size_t size);
+void logq_destroy(logq_t *q);
+err_t logq_write(logq_t *q, logq_level_t level, const char *fmt, ...)
+    __attribute__((format(printf,3,4)));
+size_t logq_drain(logq_t *q, FILE *out);
+void logq_set_level(logq_t *q, logq_level_t level);
+err_t logq_level_from_str(logq_level_t *level, const char *str);
+const char *logq_level_str(logq_level_t level);
+void logq_stats(logq_t *q, size_t *n_logged, size_t *n_dropped);
+/* Checks the level before any arguments are evaluated */
+#define logq_log(q,lvl,...) do { \
+    if ((int)(lvl) <= atomic_load_explicit(&(q)->level,memory_order_relaxed)) { \
+        logq_write(q,lvl,__VA_ARGS__); \
+    } \
+} while (0)
+
+#endif /* LOGQ_H */
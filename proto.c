@@ -0,0 +1,294 @@
+/* Binary control messages */
+#include "proto.h"
+#include <math.h>
+
+static inline uint32_t get_u32(const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8)
+        | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t get_u64(const uint8_t *p)
+{
+    return (uint64_t)get_u32(p) | ((uint64_t)get_u32(p + 4) << 32);
+}
+
+static inline uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline f64_t get_f32(const uint8_t *p)
+{
+    union { uint32_t u; float f; } x = { .u = get_u32(p) };
+    return x.f;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+static inline void put_u64(uint8_t *p, uint64_t x)
+{
+    put_u32(p,x);
+    put_u32(p + 4,x >> 32);
+}
+
+static inline void put_u16(uint8_t *p, uint16_t x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+static inline void put_f32(uint8_t *p, f64_t f)
+{
+    union { float f; uint32_t u; } x = { .f = f };
+    put_u32(p,x.u);
+}
+
+/* Checks the header of the len bytes at buf. buf must stay valid while
+ * messages are read. */
+err_t proto_dec_init(proto_dec_t *d, const void *buf, size_t len)
+{
+    _MZ(d,proto_dec_t,1);
+    const uint8_t *p = buf;
+    if ((len < PROTO_HDR_LEN) || (p[0] != PROTO_MAGIC)
+            || (p[1] != PROTO_VERSION)) {
+        return err_EINVAL;
+    }
+    d->buf = p;
+    d->len = len;
+    d->_off = PROTO_HDR_LEN;
+    d->_left = get_u16(p + 2);
+    return err_NONE;
+}
+
+static err_t get_note(proto_msg_t *m, const uint8_t *p)
+{
+    m->tick = get_u32(p);
+    m->note = SEQ_EVENT_INIT_DEFAULT;
+    m->note.freq = get_f32(p + 4);
+    m->note.env.a = get_f32(p + 8);
+    m->note.env.d = get_f32(p + 12);
+    m->note.env.s = get_f32(p + 16);
+    m->note.env.r = get_f32(p + 20);
+    m->note.env.max_amp = get_f32(p + 24);
+    m->note.env.sus_amp = get_f32(p + 28);
+    m->note.env.curve = p[32];
+    return seq_event_check(&m->note);
+}
+
+/* Decodes the next message into m. Returns err_NFND when there are no
+ * more and err_EINVAL if the message does not fit in the datagram or its
+ * fields are out of range, after which the rest of the datagram is
+ * ignored. m->type is 0 if not even the type could be read. */
+err_t proto_dec_next(proto_dec_t *d, proto_msg_t *m)
+{
+    if (d->_left == 0) {
+        return err_NFND;
+    }
+    m->type = 0;
+    if (d->len - d->_off < PROTO_MSG_HDR_LEN) {
+        d->_left = 0;
+        return err_EINVAL;
+    }
+    const uint8_t *p = d->buf + d->_off;
+    size_t blen = get_u16(p + 2);
+    if (d->len - d->_off - PROTO_MSG_HDR_LEN < blen) {
+        d->_left = 0;
+        return err_EINVAL;
+    }
+    d->_off += PROTO_MSG_HDR_LEN + blen;
+    d->_left--;
+    m->type = p[0];
+    m->track = p[1];
+    p += PROTO_MSG_HDR_LEN;
+    switch (m->type) {
+        case proto_type_NOTE:
+            if (blen < PROTO_NOTE_LEN) {
+                return err_EINVAL;
+            }
+            return get_note(m,p);
+        case proto_type_UPDATE:
+            if (blen < PROTO_UPDATE_LEN) {
+                return err_EINVAL;
+            }
+            m->id = get_u64(p);
+            return get_note(m,p + PROTO_ID_LEN);
+        case proto_type_VOICES:
+            if (blen < PROTO_VOICES_LEN) {
+                return err_EINVAL;
+            }
+            m->nvoices = get_u32(p);
+            break;
+        case proto_type_UNNOTE:
+        case proto_type_ID:
+            if (blen < PROTO_ID_LEN) {
+                return err_EINVAL;
+            }
+            m->id = get_u64(p);
+            break;
+        case proto_type_CLEAR:
+            break;
+        case proto_type_TEMPO:
+            if (blen < PROTO_TEMPO_LEN) {
+                return err_EINVAL;
+            }
+            m->tempo_s = get_f32(p);
+            m->has_tick = blen >= PROTO_TEMPO_AT_LEN;
+            if (m->has_tick) {
+                m->tick = get_u32(p + 4);
+                m->ramp = p[8];
+            }
+            if (!(m->tempo_s > 0) || isinf(m->tempo_s) || (m->has_tick && (m->ramp > 1))) {
+                return err_EINVAL;
+            }
+            break;
+        case proto_type_REMOVE:
+            if (blen < PROTO_REMOVE_LEN) {
+                return err_EINVAL;
+            }
+            m->tick = get_u32(p);
+            m->freq = get_f32(p + 4);
+            break;
+        default:
+            return err_EINVAL;
+    }
+    return err_NONE;
+}
+
+/* The proto_put functions write one item at buf and return its length, or
+ * 0 if it needs more than cap bytes. */
+
+size_t proto_put_header(uint8_t *buf, size_t cap, unsigned int count)
+{
+    if ((cap < PROTO_HDR_LEN) || (count > UINT16_MAX)) {
+        return 0;
+    }
+    buf[0] = PROTO_MAGIC;
+    buf[1] = PROTO_VERSION;
+    put_u16(buf + 2,count);
+    return PROTO_HDR_LEN;
+}
+
+/* Addresses the message put at msg to track, which is 0 otherwise */
+err_t proto_set_track(uint8_t *msg, unsigned int track)
+{
+    if (track > UINT8_MAX) {
+        return err_EINVAL;
+    }
+    msg[1] = track;
+    return err_NONE;
+}
+
+static size_t put_msg_hdr(uint8_t *buf, size_t cap, proto_type_t type, size_t blen)
+{
+    if (cap < PROTO_MSG_HDR_LEN + blen) {
+        return 0;
+    }
+    _MZ(buf,uint8_t,PROTO_MSG_HDR_LEN + blen);
+    buf[0] = type;
+    buf[1] = 0;
+    put_u16(buf + 2,blen);
+    return PROTO_MSG_HDR_LEN + blen;
+}
+
+static void put_note(uint8_t *p, size_t tick, const seq_event_t *se)
+{
+    put_u32(p,tick);
+    put_f32(p + 4,se->freq);
+    put_f32(p + 8,se->env.a);
+    put_f32(p + 12,se->env.d);
+    put_f32(p + 16,se->env.s);
+    put_f32(p + 20,se->env.r);
+    put_f32(p + 24,se->env.max_amp);
+    put_f32(p + 28,se->env.sus_amp);
+    p[32] = se->env.curve;
+}
+
+size_t proto_put_note(uint8_t *buf, size_t cap, size_t tick, const seq_event_t *se)
+{
+    size_t ret = put_msg_hdr(buf,cap,proto_type_NOTE,PROTO_NOTE_LEN);
+    if (ret) {
+        put_note(buf + PROTO_MSG_HDR_LEN,tick,se);
+    }
+    return ret;
+}
+
+size_t proto_put_clear(uint8_t *buf, size_t cap)
+{
+    return put_msg_hdr(buf,cap,proto_type_CLEAR,0);
+}
+
+size_t proto_put_tempo(uint8_t *buf, size_t cap, f64_t tempo_s)
+{
+    size_t ret = put_msg_hdr(buf,cap,proto_type_TEMPO,PROTO_TEMPO_LEN);
+    if (ret) {
+        put_f32(buf + PROTO_MSG_HDR_LEN,tempo_s);
+    }
+    return ret;
+}
+
+size_t proto_put_tempo_at(uint8_t *buf, size_t cap, f64_t tempo_s, size_t tick, int ramp)
+{
+    size_t ret = put_msg_hdr(buf,cap,proto_type_TEMPO,PROTO_TEMPO_AT_LEN);
+    if (ret) {
+        put_f32(buf + PROTO_MSG_HDR_LEN,tempo_s);
+        put_u32(buf + PROTO_MSG_HDR_LEN + 4,tick);
+        buf[PROTO_MSG_HDR_LEN + 8] = ramp != 0;
+        memset(buf + PROTO_MSG_HDR_LEN + 9,0,3);
+    }
+    return ret;
+}
+
+size_t proto_put_remove(uint8_t *buf, size_t cap, size_t tick, f64_t freq)
+{
+    size_t ret = put_msg_hdr(buf,cap,proto_type_REMOVE,PROTO_REMOVE_LEN);
+    if (ret) {
+        put_u32(buf + PROTO_MSG_HDR_LEN,tick);
+        put_f32(buf + PROTO_MSG_HDR_LEN + 4,freq);
+    }
+    return ret;
+}
+
+static size_t put_id_msg(uint8_t *buf, size_t cap, proto_type_t type, seq_event_id_t id)
+{
+    size_t ret = put_msg_hdr(buf,cap,type,PROTO_ID_LEN);
+    if (ret) {
+        put_u64(buf + PROTO_MSG_HDR_LEN,id);
+    }
+    return ret;
+}
+
+size_t proto_put_unnote(uint8_t *buf, size_t cap, seq_event_id_t id)
+{
+    return put_id_msg(buf,cap,proto_type_UNNOTE,id);
+}
+
+size_t proto_put_update(uint8_t *buf, size_t cap, seq_event_id_t id, size_t tick, const seq_event_t *se)
+{
+    size_t ret = put_msg_hdr(buf,cap,proto_type_UPDATE,PROTO_UPDATE_LEN);
+    if (ret) {
+        put_u64(buf + PROTO_MSG_HDR_LEN,id);
+        put_note(buf + PROTO_MSG_HDR_LEN + PROTO_ID_LEN,tick,se);
+    }
+    return ret;
+}
+
+size_t proto_put_id(uint8_t *buf, size_t cap, seq_event_id_t id)
+{
+    return put_id_msg(buf,cap,proto_type_ID,id);
+}
+
+size_t proto_put_voices(uint8_t *buf, size_t cap, size_t nvoices)
+{
+    size_t ret = put_msg_hdr(buf,cap,proto_type_VOICES,PROTO_VOICES_LEN);
+    if (ret) {
+        put_u32(buf + PROTO_MSG_HDR_LEN,nvoices > UINT32_MAX ? UINT32_MAX : nvoices);
+    }
+    return ret;
+}
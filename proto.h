@@ -0,0 +1,101 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "seq.h"
+
+/* Binary control messages. A datagram is a header followed by count
+ * messages, all little-endian with fixed layouts:
+ *
+ *   header   u8 magic (PROTO_MAGIC), u8 version, u16 count
+ *   message  u8 type, u8 track, u16 body length, body
+ *
+ *   note     u32 tick, f32 freq, a, d, s, r, max_amp, sus_amp,
+ *            u8 curve, u8[3] 0
+ *   clear    (empty)
+ *   tempo    f32 tick length in seconds, then optionally
+ *            u32 tick, u8 ramp, u8[3] 0
+ *   remove   u32 tick, f32 freq
+ *   unnote   u64 id
+ *   update   u64 id, then a note's body
+ *   id       u64 id, or 0 if the note had none
+ *   voices   u32 most voices the track plays at once
+ *
+ * id messages are only sent back, one for each note in the datagram in
+ * order, so the notes can later be removed or updated. IDs are only
+ * unique within a track.
+ *
+ * A tempo without a tick sets the tick length everywhere, with one it sets
+ * a point of the tempo map (see seq.h) that ramps to the next if ramp is 1.
+ *
+ * The magic byte is not printable so binary and text datagrams can share
+ * a port. Bodies longer than a type needs are accepted and the rest is
+ * skipped, so later versions can add fields at the end. */
+
+#define PROTO_MAGIC 0xb5
+#define PROTO_VERSION 1
+#define PROTO_HDR_LEN 4
+#define PROTO_MSG_HDR_LEN 4
+#define PROTO_NOTE_LEN 36
+#define PROTO_TEMPO_LEN 4
+#define PROTO_TEMPO_AT_LEN 12
+#define PROTO_REMOVE_LEN 8
+#define PROTO_ID_LEN 8
+#define PROTO_VOICES_LEN 4
+#define PROTO_UPDATE_LEN (PROTO_ID_LEN + PROTO_NOTE_LEN)
+
+typedef enum proto_type_t {
+    proto_type_NOTE = 1,
+    proto_type_CLEAR,
+    proto_type_TEMPO,
+    proto_type_REMOVE,
+    proto_type_UNNOTE,
+    proto_type_UPDATE,
+    proto_type_ID,
+    proto_type_VOICES
+} proto_type_t;
+
+/* A decoded message. Fields not used by type are left unset. */
+typedef struct proto_msg_t {
+    proto_type_t type;
+    unsigned int track;
+    size_t tick;
+    seq_event_t note; /* proto_type_NOTE, proto_type_UPDATE */
+    seq_event_id_t id;/* proto_type_UNNOTE, proto_type_UPDATE, proto_type_ID */
+    f64_t tempo_s;    /* proto_type_TEMPO, with tick if has_tick */
+    int has_tick;
+    int ramp;
+    f64_t freq;       /* proto_type_REMOVE */
+    size_t nvoices;   /* proto_type_VOICES */
+} proto_msg_t;
+
+/* Reads a datagram in place, one message at a time */
+typedef struct proto_dec_t {
+    const uint8_t *buf;
+    size_t len;
+    size_t _off;
+    size_t _left; /* messages still to be read */
+} proto_dec_t;
+
+#define proto_is_bin(buf,len) (((len) > 0) && (((const uint8_t*)(buf))[0] == PROTO_MAGIC))
+
+err_t proto_dec_init(proto_dec_t *d, const void *buf, size_t len);
+err_t proto_dec_next(proto_dec_t *d, proto_msg_t *m);
+
+size_t proto_put_header(uint8_t *buf, size_t cap, unsigned int count);
+err_t proto_set_track(uint8_t *msg, unsigned int track);
+size_t proto_put_note(uint8_t *buf, size_t cap, size_t tick, const seq_event_t *se);
+size_t proto_put_clear(uint8_t *buf, size_t cap);
+size_t proto_put_tempo(uint8_t *buf, size_t cap, f64_t tempo_s);
+size_t proto_put_tempo_at(uint8_t *buf, size_t cap, f64_t tempo_s, size_t tick, int ramp);
+size_t proto_put_remove(uint8_t *buf, size_t cap, size_t tick, f64_t freq);
+size_t proto_put_unnote(uint8_t *buf, size_t cap, seq_event_id_t id);
+size_t proto_put_update(uint8_t *buf, size_t cap, seq_event_id_t id, size_t tick, const seq_event_t *se);
+size_t proto_put_id(uint8_t *buf, size_t cap, seq_event_id_t id);
+size_t proto_put_voices(uint8_t *buf, size_t cap, size_t nvoices);
+
+#endif /* PROTO_H */
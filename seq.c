@@ -1,38 +1,324 @@
 #include "seq.h"
 #include <stdio.h> 
+#include <math.h>
 
-err_t seq_init(seq_t *s, size_t seq_len, size_t n_events_per_tick, f64_t tick_len)
+/* Memory is 4 bytes and a bit per tick plus pool_size events, however
+ * the events are spread over the ticks. */
+size_t seq_mem_size(size_t seq_len, size_t pool_size)
 {
-    s->events = _C(seq_event_t*,seq_len*n_events_per_tick);
-    if (!s->events) {
+    return arena_size(seq_len * sizeof(uint32_t))
+        + arena_size((seq_len + 63) / 64 * sizeof(uint64_t))
+        + arena_size(pool_size * sizeof(seq_event_t))
+        + 6 * arena_size(pool_size * sizeof(uint32_t));
+}
+
+static int tick_len_ok(f64_t tick_len)
+{
+    return isfinite(tick_len) && (tick_len >= SEQ_TICK_MIN);
+}
+
+/* Takes seq_mem_size(seq_len,pool_size) bytes from arena */
+err_t seq_init(seq_t *s,
+               size_t seq_len,
+               f64_t tick_len,
+               size_t pool_size,
+               arena_t *arena)
+{
+    size_t n;
+    _MZ(s,seq_t,1);
+    if ((seq_len == 0) || (pool_size == 0) || (pool_size >= SEQ_NIL)
+            || !tick_len_ok(tick_len)) {
+        return err_EINVAL;
+    }
+    s->_arena = arena;
+    s->_lists_arena = arena;
+    s->_heads = arena_alloc(arena,seq_len * sizeof(uint32_t));
+    s->_nonempty = arena_alloc(arena,(seq_len + 63) / 64 * sizeof(uint64_t));
+    s->_pool = arena_alloc(arena,pool_size * sizeof(seq_event_t));
+    s->_pool_epoch = arena_alloc(arena,pool_size * sizeof(uint32_t));
+    s->_free = arena_alloc(arena,pool_size * sizeof(uint32_t));
+    s->_id_slot = arena_alloc(arena,pool_size * sizeof(uint32_t));
+    s->_id_tag = arena_alloc(arena,pool_size * sizeof(uint32_t));
+    s->_slot_id = arena_alloc(arena,pool_size * sizeof(uint32_t));
+    s->_id_free = arena_alloc(arena,pool_size * sizeof(uint32_t));
+    if (!(s->_heads && s->_nonempty && s->_pool && s->_pool_epoch && s->_free
+            && s->_id_slot && s->_id_tag && s->_slot_id && s->_id_free)) {
+        seq_destroy(s);
         return err_MEM;
     }
-    s->tick_len = tick_len;
     s->_seq_len = seq_len;
-    s->_n_events_per_tick = n_events_per_tick;
-    return err_EINVAL;
+    seq_tempo_reset(s,tick_len);
+    for (n = 0; n < seq_len; n++) {
+        s->_heads[n] = SEQ_NIL;
+    }
+    s->pool_size = pool_size;
+    /* lowest slots on top so the events in use stay packed */
+    for (s->_nfree = 0; s->_nfree < pool_size; s->_nfree++) {
+        s->_free[s->_nfree] = pool_size - 1 - s->_nfree;
+    }
+    for (s->_nid_free = 0; s->_nid_free < pool_size; s->_nid_free++) {
+        s->_id_free[s->_nid_free] = pool_size - 1 - s->_nid_free;
+        s->_id_slot[s->_nid_free] = SEQ_NIL;
+        s->_id_tag[s->_nid_free] = 1;
+        s->_slot_id[s->_nid_free] = SEQ_NIL;
+    }
+    s->_epoch = 1;
+    return err_NONE;
 }
 
 void seq_destroy(seq_t *s)
 {
-    _F(s->events);
+    arena_t *a = s->_arena;
+    arena_free(s->_lists_arena,s->_heads);
+    arena_free(s->_lists_arena,s->_nonempty);
+    arena_free(a,s->_pool);
+    arena_free(a,s->_pool_epoch);
+    arena_free(a,s->_free);
+    arena_free(a,s->_id_slot);
+    arena_free(a,s->_id_tag);
+    arena_free(a,s->_slot_id);
+    arena_free(a,s->_id_free);
     _MZ(s,seq_t,1);
 }
 
+/* Returns an unused event from the pool or NULL if all are in use. Only
+ * called by the control thread. */
+seq_event_t *seq_event_acquire(seq_t *s)
+{
+    if (s->_nfree == 0) {
+        s->pool_n_exhausted++;
+        return NULL;
+    }
+    uint32_t n = s->_free[--s->_nfree];
+    s->_pool_epoch[n] = s->_epoch;
+    s->pool_used++;
+    if (s->pool_used > s->pool_hwm) {
+        s->pool_hwm = s->pool_used;
+    }
+    return &s->_pool[n];
+}
+
+/* Puts an event back in the pool. Only called by the control thread once
+ * the sequence no longer refers to e. */
+void seq_event_release(seq_t *s, seq_event_t *e)
+{
+    size_t n = e - s->_pool;
+    if ((n >= s->pool_size) || (s->_pool_epoch[n] == 0)) {
+        return;
+    }
+    if (s->_slot_id[n] != SEQ_NIL) {
+        seq_event_drop_id(s,(seq_event_id_t)s->_id_tag[s->_slot_id[n]] << 32
+                            | s->_slot_id[n]);
+    }
+    s->_pool_epoch[n] = 0;
+    s->_free[s->_nfree++] = n;
+    s->pool_used--;
+}
+
+/* Starts a new epoch and returns it. Events acquired from now on belong to
+ * it, so once the sequence has been cleared every event of an earlier
+ * epoch can be released with seq_pool_release_before. */
+uint32_t seq_pool_new_epoch(seq_t *s)
+{
+    if (++s->_epoch == 0) {
+        s->_epoch = 1;
+    }
+    return s->_epoch;
+}
+
+/* Releases every event acquired before epoch. */
+void seq_pool_release_before(seq_t *s, uint32_t epoch)
+{
+    size_t n;
+    for (n = 0; n < s->pool_size; n++) {
+        if (s->_pool_epoch[n] && ((int32_t)(epoch - s->_pool_epoch[n]) > 0)) {
+            seq_event_release(s,&s->_pool[n]);
+        }
+    }
+}
+
+#define id_handle(id) ((uint32_t)(id))
+#define id_tag(id) ((uint32_t)((id) >> 32))
+
+/* Gives e, which has been queued to be added, an ID, or returns 0 if none
+ * are left. The ID finds it with seq_event_lookup until it is released or
+ * the sequence is cleared. Only called by the control thread. */
+seq_event_id_t seq_event_id(seq_t *s, seq_event_t *e)
+{
+    uint32_t n = e - s->_pool, h;
+    if (s->_nid_free == 0) {
+        return 0;
+    }
+    h = s->_id_free[--s->_nid_free];
+    s->_id_slot[h] = n;
+    s->_slot_id[n] = h;
+    return (seq_event_id_t)s->_id_tag[h] << 32 | h;
+}
+
+/* Returns the event named by id, or NULL if it has been removed or the
+ * sequence cleared since. Only called by the control thread. */
+seq_event_t *seq_event_lookup(seq_t *s, seq_event_id_t id)
+{
+    uint32_t h = id_handle(id), n;
+    if ((h >= s->pool_size) || (s->_id_tag[h] != id_tag(id))
+            || ((n = s->_id_slot[h]) == SEQ_NIL)
+            || (s->_pool_epoch[n] != s->_epoch)) {
+        return NULL;
+    }
+    return &s->_pool[n];
+}
+
+/* Frees id so it no longer finds its event, e.g. once a removal of the
+ * event has been queued. Only called by the control thread. */
+void seq_event_drop_id(seq_t *s, seq_event_id_t id)
+{
+    uint32_t h = id_handle(id);
+    if ((h >= s->pool_size) || (s->_id_tag[h] != id_tag(id))
+            || (s->_id_slot[h] == SEQ_NIL)) {
+        return;
+    }
+    s->_slot_id[s->_id_slot[h]] = SEQ_NIL;
+    s->_id_slot[h] = SEQ_NIL;
+    if (++s->_id_tag[h] == 0) {
+        s->_id_tag[h] = 1;
+    }
+    s->_id_free[s->_nid_free++] = h;
+}
+
+/* Makes id name e, which has been queued to replace its event. Only called
+ * by the control thread. */
+void seq_event_move_id(seq_t *s, seq_event_id_t id, seq_event_t *e)
+{
+    uint32_t h = id_handle(id), n = e - s->_pool;
+    if (!seq_event_lookup(s,id)) {
+        return;
+    }
+    s->_slot_id[s->_id_slot[h]] = SEQ_NIL;
+    s->_id_slot[h] = n;
+    s->_slot_id[n] = h;
+}
+
+
+#define event_at(s,i) (&(s)->_pool[i])
+#define event_idx(s,e) ((uint32_t)((e) - (s)->_pool))
+
+/* Puts e, from s's pool, last in the list at tick of heads */
+static void list_append(seq_t *s, uint32_t *heads, uint64_t *nonempty,
+                        seq_event_t *e, size_t tick)
+{
+    uint32_t n = event_idx(s,e),
+             head = heads[tick];
+    e->_next = SEQ_NIL;
+    e->_tick = tick;
+    if (head == SEQ_NIL) {
+        e->_prev = n;
+        heads[tick] = n;
+        nonempty[tick / 64] |= (uint64_t)1 << (tick % 64);
+    } else {
+        /* the head's prev is the tail */
+        seq_event_t *h = event_at(s,head);
+        e->_prev = h->_prev;
+        event_at(s,h->_prev)->_next = n;
+        h->_prev = n;
+    }
+}
+
+/* Adds e, which must come from the pool, after the events already at tick.
+ * It is first played the next time around. */
 err_t seq_add_event(seq_t *s, seq_event_t *e, size_t tick)
 {
     if (tick >= s->_seq_len) {
         return err_EINVAL;
     }
-    size_t n = 0;
-    do {
-        if (s->events[s->_n_events_per_tick * tick + n] == NULL) {
-            s->events[s->_n_events_per_tick * tick + n] = e;
-            return err_NONE;
+    list_append(s,s->_heads,s->_nonempty,e,tick);
+    seq_event_set_played(s,e);
+    s->nevents++;
+    return err_NONE;
+}
+
+/* Takes e out of the list at tick of heads */
+static void list_unlink(seq_t *s, uint32_t *heads, uint64_t *nonempty,
+                        seq_event_t *e, size_t tick)
+{
+    uint32_t n = event_idx(s,e),
+             head = heads[tick];
+    seq_event_t *h = event_at(s,head);
+    if (n == head) {
+        heads[tick] = e->_next;
+        if (e->_next == SEQ_NIL) {
+            nonempty[tick / 64] &= ~((uint64_t)1 << (tick % 64));
+        } else {
+            event_at(s,e->_next)->_prev = e->_prev;
         }
-        n++;
-    } while (n < s->_n_events_per_tick);
-    return err_FULL;
+    } else {
+        event_at(s,e->_prev)->_next = e->_next;
+        if (e->_next == SEQ_NIL) {
+            h->_prev = e->_prev;
+        } else {
+            event_at(s,e->_next)->_prev = e->_prev;
+        }
+    }
+    e->_tick = SEQ_NIL;
+}
+
+/* Takes e out of the list at tick */
+static void unlink_event(seq_t *s, seq_event_t *e, size_t tick)
+{
+    list_unlink(s,s->_heads,s->_nonempty,e,tick);
+    s->nevents--;
+}
+
+/* Takes e out of the sequence. Returns err_NFND if it isn't in it. */
+err_t seq_unlink_event(seq_t *s, seq_event_t *e)
+{
+    if (e->_tick == SEQ_NIL) {
+        return err_NFND;
+    }
+    unlink_event(s,e,e->_tick);
+    return err_NONE;
+}
+
+/* Puts e in the sequence at tick in place of old, which is taken out. If
+ * the tick is the same e takes old's place among the events there,
+ * otherwise it goes after them. Either way it is played this time around
+ * only if old would have been. Returns err_NFND if old isn't in the
+ * sequence. */
+err_t seq_replace_event(seq_t *s, seq_event_t *old, seq_event_t *e, size_t tick)
+{
+    uint32_t played = old->played;
+    if (old->_tick == SEQ_NIL) {
+        return err_NFND;
+    }
+    if (tick >= s->_seq_len) {
+        return err_EINVAL;
+    }
+    if (old->_tick != tick) {
+        unlink_event(s,old,old->_tick);
+        seq_add_event(s,e,tick);
+    } else {
+        /* splice e in where old was */
+        uint32_t n = event_idx(s,e), o = event_idx(s,old);
+        *e = (seq_event_t) {
+            .freq = e->freq,
+            .env = e->env,
+            ._next = old->_next,
+            ._prev = old->_prev == o ? n : old->_prev,
+            ._tick = tick
+        };
+        if (s->_heads[tick] == o) {
+            s->_heads[tick] = n;
+        } else {
+            event_at(s,old->_prev)->_next = n;
+        }
+        if (old->_next == SEQ_NIL) {
+            event_at(s,s->_heads[tick])->_prev = n;
+        } else {
+            event_at(s,old->_next)->_prev = n;
+        }
+        old->_tick = SEQ_NIL;
+    }
+    e->played = played;
+    return err_NONE;
 }
 
 /* Removes event if cmp function returns 0.
@@ -43,74 +329,347 @@ seq_event_t *seq_remove_event(seq_t *s, size_t tick, int (*cmp)(seq_event_t *, v
     if (tick >= s->_seq_len) {
         return NULL;
     }
-    size_t n = 0;
-    do {
-        if (s->events[s->_n_events_per_tick * tick + n]) {
-            int dorm = 0;
-            if (cmp) {
-                dorm = cmp(s->events[s->_n_events_per_tick * tick + n],data);
-            }
-            if (dorm == 0) {
-                seq_event_t *tmp = s->events[s->_n_events_per_tick * tick + n];
-                s->events[s->_n_events_per_tick * tick + n] = NULL;
-                return tmp;
-            }
+    seq_event_t *se;
+    for (se = seq_first_at_tick(s,tick); se; se = seq_next_event(s,se)) {
+        if ((cmp == NULL) || (cmp(se,data) == 0)) {
+            unlink_event(s,se,tick);
+            return se;
         }
-        n++;
-    } while (n < s->_n_events_per_tick);
+    }
     return NULL;
 }
 
+/* Returns the first tick at or after tick with events, or seq_len if there
+ * is none. Empty stretches are skipped 64 ticks at a time. */
+size_t seq_next_tick(seq_t *s, size_t tick)
+{
+    if (tick >= s->_seq_len) {
+        return s->_seq_len;
+    }
+    size_t w = tick / 64,
+           nwords = (s->_seq_len + 63) / 64;
+    uint64_t bits = s->_nonempty[w] & (~(uint64_t)0 << (tick % 64));
+    while (bits == 0) {
+        if (++w == nwords) {
+            return s->_seq_len;
+        }
+        bits = s->_nonempty[w];
+    }
+    return w * 64 + __builtin_ctzll(bits);
+}
+
+seq_event_t *seq_first_at_tick(seq_t *s, size_t tick)
+{
+    if ((tick >= s->_seq_len) || (s->_heads[tick] == SEQ_NIL)) {
+        return NULL;
+    }
+    return event_at(s,s->_heads[tick]);
+}
+
+seq_event_t *seq_next_event(seq_t *s, seq_event_t *se)
+{
+    return se->_next == SEQ_NIL ? NULL : event_at(s,se->_next);
+}
+
+/* Removes every event and puts it back in the pool. Only call when the
+ * audio thread is not using the sequence. */
 void seq_remove_all_events(seq_t *s)
 {
     size_t n;
-    for (n = 0; n < s->_seq_len; n++) {
+    for (n = seq_next_tick(s,0); n < s->_seq_len; n = seq_next_tick(s,n + 1)) {
         seq_event_t *se;
         while ((se = seq_remove_event(s,n,NULL,NULL))) {
-            seq_event_free(se);
+            seq_event_release(s,se);
         }
     }
 }
 
-int seq_event_chk_freq(seq_event_t *s, f64_t freq)
+/* Removes every event without touching the pool, which is left for the
+ * control thread to reclaim. */
+void seq_clear(seq_t *s)
 {
-    if (s->freq == freq) {
-        return 0;
+    size_t n;
+    for (n = seq_next_tick(s,0); n < s->_seq_len; n = seq_next_tick(s,n + 1)) {
+        s->_heads[n] = SEQ_NIL;
     }
-    return -1;
+    _MZ(s->_nonempty,uint64_t,((s->_seq_len + 63) / 64));
+    s->nevents = 0;
 }
 
-/* Call func on all events (if they aren't null) */
-void seq_events_apply(seq_t *s, void (*fun)(seq_event_t*,void*), void *data)
+/* Works out where each tempo point starts and the length of the loop */
+static void tempo_update(seq_t *s)
+{
+    size_t n;
+    double t = 0;
+    for (n = 0; n < s->ntempo; n++) {
+        seq_tempo_pt_t *p = &s->tempo[n];
+        int last = n + 1 == s->ntempo;
+        double d = (last ? s->_seq_len : p[1].tick) - p->tick;
+        f64_t next = last ? s->tempo[0].tick_len : p[1].tick_len;
+        p->_time = t;
+        p->_k = p->ramp ? (next - p->tick_len) / (2. * d) : 0;
+        t += (p->tick_len + p->_k * d) * d;
+    }
+    s->loop_time = t;
+    s->_tcur = 0;
+}
+
+/* Sets the tick length everywhere */
+void seq_tempo_reset(seq_t *s, f64_t tick_len)
 {
-    size_t n,m;
-    for (n = 0; n < s->_seq_len; n++) {
-        for (m = 0; m < s->_n_events_per_tick; m++) {
-            seq_event_t *se = 
-            s->events[s->_n_events_per_tick * n + m];
-            if (se) {
-                fun(se,data);
-            }
+    s->tempo[0] = (seq_tempo_pt_t) { .tick = 0, .tick_len = tick_len };
+    s->ntempo = 1;
+    tempo_update(s);
+}
+
+/* Puts a point in the ntempo points of tempo, in tick order, or in place
+ * of the one at its tick */
+static err_t tempo_insert(seq_tempo_pt_t *tempo, size_t *ntempo, size_t seq_len,
+                          size_t tick, f64_t tick_len, int ramp)
+{
+    size_t n;
+    if ((tick >= seq_len) || !tick_len_ok(tick_len)) {
+        return err_EINVAL;
+    }
+    for (n = 0; (n < *ntempo) && (tempo[n].tick < tick); n++);
+    if ((n == *ntempo) || (tempo[n].tick != tick)) {
+        if (*ntempo == SEQ_TEMPO_MAX) {
+            return err_FULL;
         }
+        memmove(&tempo[n + 1],&tempo[n],(*ntempo - n) * sizeof(seq_tempo_pt_t));
+        (*ntempo)++;
     }
+    tempo[n] = (seq_tempo_pt_t) { .tick = tick, .tick_len = tick_len, .ramp = ramp };
+    return err_NONE;
 }
 
-static void set_unplayed(seq_event_t *se, void *data)
+/* Sets the tick length from tick on, replacing any point there, and if ramp
+ * is set changes it linearly up to the next point. Returns err_FULL if
+ * there are SEQ_TEMPO_MAX points already. */
+err_t seq_tempo_set(seq_t *s, size_t tick, f64_t tick_len, int ramp)
 {
-    se->played = 0;
+    err_t err = tempo_insert(s->tempo,&s->ntempo,s->_seq_len,tick,tick_len,ramp);
+    if (err == err_NONE) {
+        tempo_update(s);
+    }
+    return err;
 }
 
-void seq_events_set_unplayed(seq_t *s)
+/* Returns the time in samples from the loop start to tick, which can be
+ * fractional. Cheapest when called with ticks in order. */
+double seq_tick_time(seq_t *s, double tick)
 {
-    seq_events_apply(s,set_unplayed,NULL);
+    size_t n = s->_tcur;
+    if (tick < s->tempo[n].tick) {
+        n = 0;
+    }
+    while ((n + 1 < s->ntempo) && (s->tempo[n + 1].tick <= tick)) {
+        n++;
+    }
+    s->_tcur = n;
+    seq_tempo_pt_t *p = &s->tempo[n];
+    double d = tick - p->tick;
+    return p->_time + (p->tick_len + p->_k * d) * d;
 }
 
-seq_event_t **seq_get_events_at_tick(seq_t *s, size_t tick)
+/* Returns the tick, with a fraction, that is time samples from the loop
+ * start */
+double seq_time_tick(seq_t *s, double time)
 {
-    if (tick >= s->_seq_len) {
+    size_t n = 0;
+    while ((n + 1 < s->ntempo) && (s->tempo[n + 1]._time <= time)) {
+        n++;
+    }
+    seq_tempo_pt_t *p = &s->tempo[n];
+    double t = time - p->_time;
+    if (p->_k == 0) {
+        return p->tick + t / p->tick_len;
+    }
+    /* the root of k d^2 + tick_len d - t that is 0 when t is */
+    double disc = (double)p->tick_len * p->tick_len + 4 * p->_k * t;
+    return p->tick + 2 * t / (p->tick_len + sqrt(disc > 0 ? disc : 0));
+}
+
+/* Makes empty lists for seq_len ticks, on the heap */
+err_t seq_lists_init(seq_lists_t *l, size_t seq_len)
+{
+    size_t n;
+    _MZ(l,seq_lists_t,1);
+    l->heads = _M(uint32_t,seq_len);
+    l->nonempty = _C(uint64_t,(seq_len + 63) / 64);
+    if (!(l->heads && l->nonempty)) {
+        seq_lists_destroy(l);
+        return err_MEM;
+    }
+    for (n = 0; n < seq_len; n++) {
+        l->heads[n] = SEQ_NIL;
+    }
+    l->seq_len = seq_len;
+    return err_NONE;
+}
+
+/* Frees the lists but not the events in them */
+void seq_lists_destroy(seq_lists_t *l)
+{
+    arena_free(l->_arena,l->heads);
+    arena_free(l->_arena,l->nonempty);
+    _MZ(l,seq_lists_t,1);
+}
+
+/* Adds e, acquired from s, after the events already at tick. It is due as
+ * soon as the lists are adopted. Only called by the control thread. */
+err_t seq_lists_add(seq_t *s, seq_lists_t *l, seq_event_t *e, size_t tick)
+{
+    if (tick >= l->seq_len) {
+        return err_EINVAL;
+    }
+    list_append(s,l->heads,l->nonempty,e,tick);
+    e->played = SEQ_NIL;
+    l->nevents++;
+    return err_NONE;
+}
+
+/* Takes e, which is in the lists, out of them */
+void seq_lists_unlink(seq_t *s, seq_lists_t *l, seq_event_t *e)
+{
+    list_unlink(s,l->heads,l->nonempty,e,e->_tick);
+    l->nevents--;
+}
+
+/* Takes the first event at tick for which cmp returns 0, or any if cmp is
+ * NULL, out of the lists and returns it, or NULL if there is none */
+seq_event_t *seq_lists_remove(seq_t *s, seq_lists_t *l, size_t tick,
+                              int (*cmp)(seq_event_t *, void*), void *data)
+{
+    uint32_t i;
+    if (tick >= l->seq_len) {
         return NULL;
     }
-    return &s->events[s->_n_events_per_tick * tick];
+    for (i = l->heads[tick]; i != SEQ_NIL; i = event_at(s,i)->_next) {
+        seq_event_t *se = event_at(s,i);
+        if ((cmp == NULL) || (cmp(se,data) == 0)) {
+            seq_lists_unlink(s,l,se);
+            return se;
+        }
+    }
+    return NULL;
+}
+
+/* As seq_tempo_set and seq_tempo_reset for the lists' tempo map, which
+ * replaces the whole of the sequence's once it has any points */
+err_t seq_lists_tempo_set(seq_lists_t *l, size_t tick, f64_t tick_len, int ramp)
+{
+    return tempo_insert(l->tempo,&l->ntempo,l->seq_len,tick,tick_len,ramp);
+}
+
+void seq_lists_tempo_reset(seq_lists_t *l, f64_t tick_len)
+{
+    l->tempo[0] = (seq_tempo_pt_t) { .tick = 0, .tick_len = tick_len };
+    l->ntempo = 1;
+}
+
+/* Puts every event in the lists back in s's pool and empties them. Only
+ * called by the control thread, on lists that were never adopted. */
+void seq_lists_release(seq_t *s, seq_lists_t *l)
+{
+    size_t n;
+    for (n = 0; n < l->seq_len; n++) {
+        uint32_t i = l->heads[n];
+        while (i != SEQ_NIL) {
+            seq_event_t *se = event_at(s,i);
+            i = se->_next;
+            se->_tick = SEQ_NIL;
+            seq_event_release(s,se);
+        }
+        l->heads[n] = SEQ_NIL;
+    }
+    _MZ(l->nonempty,uint64_t,((l->seq_len + 63) / 64));
+    l->nevents = 0;
+}
+
+/* Returns err_EINVAL unless the tempo points are in tick order from tick 0
+ * with positive tick lengths, or there are none */
+err_t seq_lists_check_tempo(seq_lists_t *l)
+{
+    size_t n;
+    if (l->ntempo > SEQ_TEMPO_MAX) {
+        return err_EINVAL;
+    }
+    for (n = 0; n < l->ntempo; n++) {
+        seq_tempo_pt_t *p = &l->tempo[n];
+        if (!tick_len_ok(p->tick_len) || (p->tick >= l->seq_len)
+                || (n ? p->tick <= p[-1].tick : p->tick != 0)) {
+            return err_EINVAL;
+        }
+    }
+    return err_NONE;
+}
+
+/* Swaps in the events and tempo map of l, which must be for as many ticks,
+ * and leaves the old lists in l so the control thread can reclaim them.
+ * Takes no longer however many events there are. */
+void seq_adopt(seq_t *s, seq_lists_t *l)
+{
+    uint32_t *heads = s->_heads;
+    uint64_t *nonempty = s->_nonempty;
+    size_t nevents = s->nevents;
+    arena_t *a = s->_lists_arena;
+    s->_heads = l->heads;
+    s->_nonempty = l->nonempty;
+    s->nevents = l->nevents;
+    s->_lists_arena = l->_arena;
+    l->heads = heads;
+    l->nonempty = nonempty;
+    l->nevents = nevents;
+    /* the lists a sequence starts with stay in its arena once swapped out,
+     * unused, until the arena goes */
+    l->_arena = a;
+    if (l->ntempo) {
+        memcpy(s->tempo,l->tempo,l->ntempo * sizeof(seq_tempo_pt_t));
+        s->ntempo = l->ntempo;
+        tempo_update(s);
+    }
+}
+
+int seq_event_chk_freq(seq_event_t *s, f64_t freq)
+{
+    if (s->freq == freq) {
+        return 0;
+    }
+    return -1;
+}
+
+/* Call func on all events, skipping empty ticks */
+void seq_events_apply(seq_t *s, void (*fun)(seq_event_t*,void*), void *data)
+{
+    size_t n;
+    seq_event_t *se;
+    for (n = seq_next_tick(s,0); n < s->_seq_len; n = seq_next_tick(s,n + 1)) {
+        for (se = seq_first_at_tick(s,n); se; se = seq_next_event(s,se)) {
+            fun(se,data);
+        }
+    }
+}
+
+/* Checks that an event from outside, a message or a file, can be played:
+ * every value finite, a positive frequency, no negative envelope times and
+ * a known curve. Whether the frequency suits the sample rate is left to
+ * the synth. */
+err_t seq_event_check(const seq_event_t *se)
+{
+    f64_t t[4] = { se->env.a, se->env.d, se->env.s, se->env.r };
+    size_t n;
+    for (n = 0; n < 4; n++) {
+        if (!isfinite(t[n]) || (t[n] < 0)) {
+            return err_EINVAL;
+        }
+    }
+    if (!isfinite(se->freq) || !(se->freq > 0)
+            || !isfinite(se->env.max_amp) || !isfinite(se->env.sus_amp)
+            || ((se->env.curve != env_curve_LIN) && (se->env.curve != env_curve_EXP))) {
+        return err_EINVAL;
+    }
+    return err_NONE;
 }
 
 err_t seq_event_init_from_str(seq_event_t *se,
@@ -119,16 +678,26 @@ err_t seq_event_init_from_str(seq_event_t *se,
 {
     *se = SEQ_EVENT_INIT_DEFAULT;
     *time_sec = 0.;
-    if (str) {
-        sscanf(str,"%zu %f %f %f %f %f %f %f",
-                time_sec,
-                &se->freq,
-                &se->env.a,
-                &se->env.d,
-                &se->env.s,
-                &se->env.r,
-                &se->env.max_amp,
-                &se->env.sus_amp);
+    if (!str) {
+        return err_EINVAL;
     }
-    return err_NONE;
+    int curve = se->env.curve;
+    /* tick and frequency are needed, the rest default */
+    if (sscanf(str,"%zu %f %f %f %f %f %f %f %d",
+               time_sec,
+               &se->freq,
+               &se->env.a,
+               &se->env.d,
+               &se->env.s,
+               &se->env.r,
+               &se->env.max_amp,
+               &se->env.sus_amp,
+               &curve) < 2) {
+        return err_EINVAL;
+    }
+    if ((curve != env_curve_LIN) && (curve != env_curve_EXP)) {
+        return err_EINVAL;
+    }
+    se->env.curve = curve;
+    return seq_event_check(se);
 }
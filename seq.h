@@ -4,6 +4,21 @@
 #include "err.h" 
 #include "types.h"
 #include "defs.h"
+#include "env.h"
+#include "arena.h"
+#include <stdint.h>
+
+/* Events live in a fixed pool owned by the sequence, allocated once and
+ * aligned to a cache line. The control thread acquires and releases them;
+ * the audio thread only links them into and out of the sequence and hands
+ * removed ones back (see engine.c), so it never allocates or frees.
+ * Each tick has a list of events linked by pool index, so any number of
+ * events can share a tick, and a bitmap of the ticks that have any lets
+ * walks over the sequence skip empty stretches. */
+#define SEQ_NIL UINT32_MAX
+
+/* Names an event for as long as it is in the sequence, see seq_event_id */
+typedef uint64_t seq_event_id_t;
 
 typedef struct seq_event_t {
     f64_t freq;
@@ -14,8 +29,13 @@ typedef struct seq_event_t {
         f64_t r;
         f64_t max_amp; /* maximum amplitude */
         f64_t sus_amp; /* sustain amplitude */
+        env_curve_t curve;
     } env;
-    int played;
+    uint32_t played; /* loop it was last played in, see seq_event_due, or
+                        SEQ_NIL if never */
+    uint32_t _next; /* pool index of the next event at the tick or SEQ_NIL */
+    uint32_t _prev; /* of the previous one, the last if this is the first */
+    uint32_t _tick; /* tick it is at, SEQ_NIL if not in the sequence */
 } seq_event_t;
 
 #define SEQ_EVENT_INIT_DEFAULT (seq_event_t) { \
@@ -26,26 +46,130 @@ typedef struct seq_event_t {
     .env.r = 0.5, \
     .env.max_amp = 1., \
     .env.sus_amp = 0.5, \
-    .played = 0 \
+    .env.curve = env_curve_LIN, \
+    .played = 0, \
+    ._next = SEQ_NIL, \
+    ._prev = SEQ_NIL, \
+    ._tick = SEQ_NIL \
 }
 
-typedef struct seq_t {
-    seq_event_t **events;
+/* The tempo map, which is the same every time around. From each point's
+ * tick to the next point's the tick length either holds or, if the point
+ * ramps, changes linearly to the next point's (point 0's at the end of the
+ * loop). There is always a point at tick 0. With a linear tick length the
+ * time of a tick is a quadratic in it, so converting either way is closed
+ * form. */
+#define SEQ_TEMPO_MAX 16
+/* The shortest tick length, in samples. With shorter ticks the scheduler
+ * would visit more than one tick per sample. */
+#define SEQ_TICK_MIN 1.
+
+typedef struct seq_tempo_pt_t {
+    size_t tick;
     f64_t tick_len; /* in samples */
+    int ramp;
+    double _time;   /* samples from the loop start to tick */
+    double _k;      /* half the change in tick_len per tick if ramping */
+} seq_tempo_pt_t;
+
+typedef struct seq_t {
+    uint32_t *_heads;    /* first event at each tick or SEQ_NIL */
+    uint64_t *_nonempty; /* bit per tick with events */
+    size_t nevents;
+    uint32_t loop;       /* times the sequence has come around */
+    seq_tempo_pt_t tempo[SEQ_TEMPO_MAX];
+    size_t ntempo;
+    double loop_time; /* in samples */
+    size_t _tcur;     /* point last converted in, ticks mostly go up */
     size_t _seq_len;
-    size_t _n_events_per_tick;
+    /* event pool, only touched by the control thread */
+    seq_event_t *_pool;
+    uint32_t *_pool_epoch; /* epoch an event was acquired in, 0 if free */
+    uint32_t *_free;       /* stack of free pool slots */
+    size_t pool_size;
+    size_t _nfree;
+    uint32_t _epoch;
+    /* Event IDs, also only touched by the control thread. An ID is a
+     * handle and the tag the handle had when it was given out. The handle
+     * maps to the pool slot of the event, which can change when the event
+     * is updated, and the tag changes when the handle is freed, so a stale
+     * ID never finds a newer event. */
+    uint32_t *_id_slot; /* handle -> slot or SEQ_NIL */
+    uint32_t *_id_tag;
+    uint32_t *_slot_id; /* slot -> handle or SEQ_NIL */
+    uint32_t *_id_free; /* stack of free handles */
+    size_t _nid_free;
+    /* events in use, most ever in use and acquires that found none free */
+    size_t pool_used;
+    size_t pool_hwm;
+    size_t pool_n_exhausted;
+    arena_t *_arena;
+    arena_t *_lists_arena; /* _heads and _nonempty are from, see seq_adopt */
 } seq_t;
 
-#define seq_event_free(s) _F(s) 
+/* An event is due if it hasn't been played in this loop, so starting the
+ * next loop makes every event due again without visiting any of them. The
+ * loop count skips SEQ_NIL so an event that has never played is always
+ * due. */
+#define seq_event_due(s,se) ((se)->played != (s)->loop)
+#define seq_event_set_played(s,se) ((se)->played = (s)->loop)
+#define seq_new_loop(s) ((s)->loop = (s)->loop + 1 == SEQ_NIL ? 0 : (s)->loop + 1)
+
+/* Event lists and a tempo map built on the control thread, out of events
+ * from a sequence's pool, to be swapped in whole for the sequence's own
+ * with seq_adopt. The points' _time and _k need not be set. */
+typedef struct seq_lists_t {
+    uint32_t *heads;
+    uint64_t *nonempty;
+    size_t nevents;
+    size_t seq_len;
+    seq_tempo_pt_t tempo[SEQ_TEMPO_MAX];
+    size_t ntempo;    /* 0 to keep the sequence's tempo map */
+    arena_t *_arena;  /* heads and nonempty are from */
+} seq_lists_t;
 
-err_t seq_init(seq_t *s, size_t seq_len, size_t n_events_per_tick, f64_t tick_len);
+err_t seq_init(seq_t *s,
+               size_t seq_len,
+               f64_t tick_len,
+               size_t pool_size,
+               arena_t *arena);
+size_t seq_mem_size(size_t seq_len, size_t pool_size);
 void seq_destroy(seq_t *s);
 err_t seq_add_event(seq_t *s, seq_event_t *e, size_t tick);
 seq_event_t *seq_remove_event(seq_t *, size_t tick, int (*cmp)(seq_event_t *, void*), void *data);
 void seq_remove_all_events(seq_t *s);
+void seq_clear(seq_t *s);
+seq_event_t *seq_event_acquire(seq_t *s);
+void seq_event_release(seq_t *s, seq_event_t *e);
+uint32_t seq_pool_new_epoch(seq_t *s);
+seq_event_id_t seq_event_id(seq_t *s, seq_event_t *e);
+seq_event_t *seq_event_lookup(seq_t *s, seq_event_id_t id);
+void seq_event_drop_id(seq_t *s, seq_event_id_t id);
+void seq_event_move_id(seq_t *s, seq_event_id_t id, seq_event_t *e);
+err_t seq_unlink_event(seq_t *s, seq_event_t *e);
+err_t seq_replace_event(seq_t *s, seq_event_t *old, seq_event_t *e, size_t tick);
+void seq_pool_release_before(seq_t *s, uint32_t epoch);
 int seq_event_chk_freq(seq_event_t *s, f64_t freq);
-void seq_events_set_unplayed(seq_t *s);
-seq_event_t **seq_get_events_at_tick(seq_t *s, size_t tick);
+void seq_events_apply(seq_t *s, void (*fun)(seq_event_t*,void*), void *data);
+size_t seq_next_tick(seq_t *s, size_t tick);
+seq_event_t *seq_first_at_tick(seq_t *s, size_t tick);
+seq_event_t *seq_next_event(seq_t *s, seq_event_t *se);
+void seq_tempo_reset(seq_t *s, f64_t tick_len);
+err_t seq_tempo_set(seq_t *s, size_t tick, f64_t tick_len, int ramp);
+double seq_tick_time(seq_t *s, double tick);
+double seq_time_tick(seq_t *s, double time);
+err_t seq_lists_init(seq_lists_t *l, size_t seq_len);
+void seq_lists_destroy(seq_lists_t *l);
+err_t seq_lists_add(seq_t *s, seq_lists_t *l, seq_event_t *e, size_t tick);
+void seq_lists_unlink(seq_t *s, seq_lists_t *l, seq_event_t *e);
+seq_event_t *seq_lists_remove(seq_t *s, seq_lists_t *l, size_t tick,
+                              int (*cmp)(seq_event_t *, void*), void *data);
+err_t seq_lists_tempo_set(seq_lists_t *l, size_t tick, f64_t tick_len, int ramp);
+void seq_lists_tempo_reset(seq_lists_t *l, f64_t tick_len);
+void seq_lists_release(seq_t *s, seq_lists_t *l);
+err_t seq_lists_check_tempo(seq_lists_t *l);
+void seq_adopt(seq_t *s, seq_lists_t *l);
+err_t seq_event_check(const seq_event_t *se);
 err_t seq_event_init_from_str(seq_event_t *se,
                               size_t *time_sec,
                               char *str);
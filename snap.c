@@ -0,0 +1,173 @@
+/* Sequence snapshots */
+#include "snap.h"
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Maps the snapshot at path and checks that its header, track table and
+ * event arrays are all there. The events themselves are checked as they
+ * are used. */
+err_t snap_open(snap_t *sn, const char *path)
+{
+    struct stat st;
+    size_t n;
+    int fd;
+    _MZ(sn,snap_t,1);
+    if ((fd = open(path,O_RDONLY)) < 0) {
+        return err_NFND;
+    }
+    if ((fstat(fd,&st) != 0) || ((size_t)st.st_size < sizeof(snap_hdr_t))) {
+        close(fd);
+        return err_EINVAL;
+    }
+    sn->_len = st.st_size;
+    sn->_map = mmap(NULL,sn->_len,PROT_READ,MAP_PRIVATE | MAP_POPULATE,fd,0);
+    close(fd);
+    if (sn->_map == MAP_FAILED) {
+        sn->_map = NULL;
+        return err_MEM;
+    }
+    sn->hdr = sn->_map;
+    sn->tracks = (const snap_track_t*)(sn->hdr + 1);
+    if ((sn->hdr->magic != SNAP_MAGIC) || (sn->hdr->version != SNAP_VERSION)
+            || (sn->hdr->event_size != sizeof(snap_event_t))
+            || (sn->hdr->size != sn->_len)
+            || (sn->hdr->ntracks == 0)
+            || (sn->hdr->ntracks > (sn->_len - sizeof(snap_hdr_t))
+                / sizeof(snap_track_t))) {
+        snap_close(sn);
+        return err_EINVAL;
+    }
+    for (n = 0; n < sn->hdr->ntracks; n++) {
+        const snap_track_t *t = &sn->tracks[n];
+        if ((t->seq_len == 0) || (t->ntempo == 0) || (t->ntempo > SEQ_TEMPO_MAX)
+                || (t->events % sizeof(uint64_t))
+                || (t->events > sn->_len)
+                || (t->nevents > (sn->_len - t->events) / sizeof(snap_event_t))) {
+            snap_close(sn);
+            return err_EINVAL;
+        }
+    }
+    return err_NONE;
+}
+
+void snap_close(snap_t *sn)
+{
+    if (sn->_map) {
+        munmap(sn->_map,sn->_len);
+    }
+    _MZ(sn,snap_t,1);
+}
+
+const snap_event_t *snap_events(snap_t *sn, size_t track)
+{
+    return (const snap_event_t*)((const char*)sn->_map + sn->tracks[track].events);
+}
+
+void snap_event_get(const snap_event_t *ev, seq_event_t *se)
+{
+    *se = SEQ_EVENT_INIT_DEFAULT;
+    se->freq = ev->freq;
+    se->env.a = ev->a;
+    se->env.d = ev->d;
+    se->env.s = ev->s;
+    se->env.r = ev->r;
+    se->env.max_amp = ev->max_amp;
+    se->env.sus_amp = ev->sus_amp;
+    se->env.curve = ev->curve;
+}
+
+/* Writes a snapshot of ntracks sequences, with the voices each may use, to
+ * path. The sequences must not change while it runs, though they can be
+ * played. */
+err_t snap_save(const char *path, f64_t sr, size_t ntracks,
+                seq_t *const *seqs, const size_t *nvoices)
+{
+    size_t n, k, tick, len = strlen(path);
+    uint64_t off = sizeof(snap_hdr_t) + ntracks * sizeof(snap_track_t);
+    char *tmp = _M(char,(len + 5));
+    snap_track_t *tracks = _C(snap_track_t,ntracks);
+    FILE *f = NULL;
+    err_t err = err_NONE;
+    if (!(tmp && tracks)) {
+        err = err_MEM;
+        goto done;
+    }
+    for (n = 0; n < ntracks; n++) {
+        seq_t *s = seqs[n];
+        snap_track_t *t = &tracks[n];
+        t->seq_len = s->_seq_len;
+        t->nvoices = nvoices[n];
+        t->nevents = s->nevents;
+        t->ntempo = s->ntempo;
+        for (k = 0; k < s->ntempo; k++) {
+            t->tempo[k] = (snap_tempo_t) {
+                .tick_len = s->tempo[k].tick_len / sr,
+                .tick = s->tempo[k].tick,
+                .ramp = s->tempo[k].ramp
+            };
+        }
+        t->events = off;
+        off += (uint64_t)t->nevents * sizeof(snap_event_t);
+    }
+    snap_hdr_t hdr = {
+        .magic = SNAP_MAGIC,
+        .version = SNAP_VERSION,
+        .ntracks = ntracks,
+        .event_size = sizeof(snap_event_t),
+        .size = off
+    };
+    memcpy(tmp,path,len);
+    memcpy(tmp + len,".tmp",5);
+    if (!(f = fopen(tmp,"wb"))) {
+        err = err_EINVAL;
+        goto done;
+    }
+    fwrite(&hdr,sizeof(hdr),1,f);
+    fwrite(tracks,sizeof(snap_track_t),ntracks,f);
+    for (n = 0; n < ntracks; n++) {
+        seq_t *s = seqs[n];
+        seq_event_t *se;
+        size_t nevents = 0;
+        for (tick = seq_next_tick(s,0); tick < s->_seq_len;
+                tick = seq_next_tick(s,tick + 1)) {
+            for (se = seq_first_at_tick(s,tick); se; se = seq_next_event(s,se)) {
+                snap_event_t ev = {
+                    .tick = tick,
+                    .freq = se->freq,
+                    .a = se->env.a,
+                    .d = se->env.d,
+                    .s = se->env.s,
+                    .r = se->env.r,
+                    .max_amp = se->env.max_amp,
+                    .sus_amp = se->env.sus_amp,
+                    .curve = se->env.curve
+                };
+                fwrite(&ev,sizeof(ev),1,f);
+                nevents++;
+            }
+        }
+        if (nevents != tracks[n].nevents) {
+            err = err_EINVAL;
+        }
+    }
+    if ((fflush(f) != 0) || ferror(f) || (fsync(fileno(f)) != 0)) {
+        err = err_EINVAL;
+    }
+    if (fclose(f) != 0) {
+        err = err_EINVAL;
+    }
+    if (err == err_NONE) {
+        if (rename(tmp,path) != 0) {
+            err = err_EINVAL;
+        }
+    } else {
+        unlink(tmp);
+    }
+done:
+    _F(tmp);
+    _F(tracks);
+    return err;
+}
@@ -0,0 +1,75 @@
+#ifndef SNAP_H
+#define SNAP_H
+
+#include <stdint.h>
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "seq.h"
+
+/* Snapshots of the sequences on disk. A snapshot is a header, a table
+ * with each track's length, voices and tempo map, then each track's events
+ * in tick order as fixed size records. Fields are in the host's byte
+ * order, which the magic number checks, and naturally aligned, so a
+ * snapshot is used straight from an mmap of the file without parsing.
+ * Tick lengths are in seconds so a snapshot can be loaded at any sample
+ * rate. A reader rejects any version but its own, and a snapshot is
+ * written to a temporary file then renamed, so a crash while saving
+ * leaves the last one whole. */
+
+#define SNAP_MAGIC 0x53504d53 /* "SMPS" */
+#define SNAP_VERSION 1
+
+typedef struct snap_hdr_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ntracks;
+    uint32_t event_size; /* sizeof(snap_event_t) */
+    uint64_t size;       /* of the whole file */
+} snap_hdr_t;
+
+typedef struct snap_tempo_t {
+    double tick_len; /* in seconds */
+    uint32_t tick;
+    uint32_t ramp;
+} snap_tempo_t;
+
+typedef struct snap_track_t {
+    uint32_t seq_len;
+    uint32_t nvoices;
+    uint32_t nevents;
+    uint32_t ntempo;
+    snap_tempo_t tempo[SEQ_TEMPO_MAX];
+    uint64_t events; /* offset of the first event from the file's start */
+} snap_track_t;
+
+typedef struct snap_event_t {
+    uint32_t tick;
+    float freq;
+    float a;
+    float d;
+    float s;
+    float r;
+    float max_amp;
+    float sus_amp;
+    uint32_t curve;
+    uint32_t _pad;
+} snap_event_t;
+
+/* A snapshot mapped for reading */
+typedef struct snap_t {
+    void *_map;
+    size_t _len;
+    const snap_hdr_t *hdr;
+    const snap_track_t *tracks;
+} snap_t;
+
+err_t snap_open(snap_t *sn, const char *path);
+void snap_close(snap_t *sn);
+const snap_event_t *snap_events(snap_t *sn, size_t track);
+void snap_event_get(const snap_event_t *ev, seq_event_t *se);
+err_t snap_save(const char *path, f64_t sr, size_t ntracks,
+                seq_t *const *seqs, const size_t *nvoices);
+
+#endif /* SNAP_H */
@@ -0,0 +1,81 @@
+/* Single-writer counters and histograms */
+#include "stats.h"
+#include <time.h>
+
+static size_t hist_bin(uint64_t v)
+{
+    if (v < STATS_HIST_SUB) {
+        return v;
+    }
+    /* the octave, then which quarter of it from the next 2 bits */
+    int k = 63 - __builtin_clzll(v);
+    return STATS_HIST_SUB * (k - 1) + ((v >> (k - 2)) & (STATS_HIST_SUB - 1));
+}
+
+/* The smallest value that falls in bin b */
+static uint64_t hist_bin_lo(size_t b)
+{
+    if (b < STATS_HIST_SUB) {
+        return b;
+    }
+    int k = b / STATS_HIST_SUB + 1;
+    return (uint64_t)(STATS_HIST_SUB + b % STATS_HIST_SUB) << (k - 2);
+}
+
+void stats_hist_init(stats_hist_t *h)
+{
+    size_t b;
+    for (b = 0; b < STATS_HIST_BINS; b++) {
+        atomic_init(&h->bins[b],0);
+    }
+    atomic_init(&h->n,0);
+    atomic_init(&h->sum,0);
+    atomic_init(&h->max,0);
+}
+
+/* Only called by the writer */
+void stats_hist_add(stats_hist_t *h, uint64_t v)
+{
+    stats_inc(&h->bins[hist_bin(v)],1);
+    stats_inc(&h->sum,v);
+    if (v > stats_get(&h->max)) {
+        stats_set(&h->max,v);
+    }
+    /* last, so a reader never sees more values than are in the bins */
+    atomic_store_explicit(&h->n,stats_get(&h->n) + 1,memory_order_release);
+}
+
+/* The bottom of the bucket holding the value q of the way up, or 0 if
+ * there are no values */
+uint64_t stats_hist_quantile(stats_hist_t *h, double q)
+{
+    uint64_t n = atomic_load_explicit(&h->n,memory_order_acquire),
+             want = (uint64_t)(q * n), seen = 0;
+    size_t b;
+    if (n == 0) {
+        return 0;
+    }
+    if (want >= n) {
+        want = n - 1;
+    }
+    for (b = 0; b < STATS_HIST_BINS; b++) {
+        seen += stats_get(&h->bins[b]);
+        if (seen > want) {
+            return hist_bin_lo(b);
+        }
+    }
+    return stats_get(&h->max);
+}
+
+double stats_hist_mean(stats_hist_t *h)
+{
+    uint64_t n = atomic_load_explicit(&h->n,memory_order_acquire);
+    return n ? (double)stats_get(&h->sum) / n : 0.;
+}
+
+uint64_t stats_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,41 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+
+/* Counters and histograms written by one thread, such as the audio thread,
+ * and read by any other at any time. The writer only does relaxed loads
+ * and stores, never a locked read-modify-write, so updating one costs
+ * about as much as a plain increment. Readers see a recent, if not quite
+ * consistent, picture. */
+
+/* Buckets are spaced a quarter octave apart, so a quantile is within 19%
+ * of the true value, and values up to 3 have a bucket each */
+#define STATS_HIST_SUB 4
+#define STATS_HIST_BINS (STATS_HIST_SUB * 63 + STATS_HIST_SUB)
+
+typedef struct stats_hist_t {
+    _Atomic uint64_t bins[STATS_HIST_BINS];
+    _Atomic uint64_t n;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} stats_hist_t;
+
+/* Only called by the writer */
+#define stats_inc(c,x) atomic_store_explicit(c, \
+    atomic_load_explicit(c,memory_order_relaxed) + (x),memory_order_relaxed)
+#define stats_set(c,x) atomic_store_explicit(c,x,memory_order_relaxed)
+#define stats_get(c) atomic_load_explicit(c,memory_order_relaxed)
+
+void stats_hist_init(stats_hist_t *h);
+void stats_hist_add(stats_hist_t *h, uint64_t v);
+uint64_t stats_hist_quantile(stats_hist_t *h, double q);
+double stats_hist_mean(stats_hist_t *h);
+uint64_t stats_now_ns(void);
+
+#endif /* STATS_H */
@@ -4,27 +4,30 @@
 #include "err.h"
 #include "types.h"
 #include "defs.h" 
+#include "env.h"
+#include "wtset.h"
+
+/* Number of envelope gains computed at a time by synth_vc_proc */
+#define SYNTH_VC_BLOCK 64
 
 typedef struct synth_vc_t {
     int playing;
     f64_t freq;
-    struct {
-        f64_t a;
-        f64_t d;
-        f64_t s;
-        f64_t r;
-        f64_t max_amp; /* maximum amplitude */
-        f64_t sus_amp; /* sustain amplitude */
-    } env;
-    f64_t _tot_tm; /* total time (sum of a,d,s,r) */
+    env_t env;
     f64_t _phs;    /* current phase [0-1] */
-    f64_t _tm;     /* current time */
 } synth_vc_t;
 
 typedef struct synth_vc_proc_t {
     f64_t sr; /* sample rate */
-    f64_t *wt; /* wavetable */
-    size_t len; /* length in samples */
+    f64_t *wt; /* wavetable, followed by a copy of its first sample */
+    size_t len; /* length in samples, not counting the copy */
+    /* if not NULL, voices in a synth_bank_t play from the level of this
+     * set that suits their frequency instead of wt (see wtset.h) */
+    const wtset_t *set;
+    /* voices whose envelopes can't rise above this gain again are ended
+     * early, at the next SYNTH_VC_BLOCK, or next block in a synth_bank_t.
+     * At 0 only voices that can't make a sound are. */
+    f64_t cull;
 } synth_vc_proc_t;
 
 typedef struct synth_vc_init_t {
@@ -35,6 +38,7 @@ typedef struct synth_vc_init_t {
     f64_t r;
     f64_t max_amp;
     f64_t sus_amp;
+    env_curve_t curve;
 } synth_vc_init_t;
 
 #define SYNTH_VC_INIT_DEFAULT (synth_vc_init_t) { \
@@ -45,6 +49,7 @@ typedef struct synth_vc_init_t {
     .r = 0.5, \
     .max_amp = 1., \
     .sus_amp = 0.5, \
+    .curve = env_curve_LIN, \
 }
 
 err_t synth_vc_init_from_str(synth_vc_init_t *svi, char *str);
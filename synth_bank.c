@@ -0,0 +1,783 @@
+/* Multi-voice oscillator bank */
+#include "synth_bank.h"
+#include <stdint.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SYNTH_BANK_X86
+#include <immintrin.h>
+#endif
+
+/* The table of each voice starts at toff in sp->wt and has tlen samples plus
+ * a guard sample, so the sample after the last is read without wrapping. */
+
+/* Each kernel is written once, as an inlined body taking lerp, and made
+ * into two: one interpolating between table samples and one taking the
+ * sample below, which is cheaper, for when there isn't time for better
+ * (see synth_bank_t.nearest). */
+#define KERN_PAIR(name,attr) \
+    static attr void name(synth_bank_t *b, synth_vc_proc_t *sp, size_t first, \
+                          synth_bank_scratch_t *sc, f64_t *out, size_t nsamps) \
+    { \
+        name##_body(b,sp,first,sc,out,nsamps,1); \
+    } \
+    static attr void name##_near(synth_bank_t *b, synth_vc_proc_t *sp, size_t first, \
+                                 synth_bank_scratch_t *sc, f64_t *out, size_t nsamps) \
+    { \
+        name##_body(b,sp,first,sc,out,nsamps,0); \
+    }
+#define KERN_BODY static inline __attribute__((always_inline))
+
+/* One voice at a time, used where no vector unit is available */
+KERN_BODY
+void kern_scalar_body(synth_bank_t *b, synth_vc_proc_t *sp, size_t first,
+                      synth_bank_scratch_t *sc, f64_t *out, size_t nsamps,
+                      int lerp)
+{
+    const f64_t *gain = sc->gain;
+    size_t n;
+    const f64_t *wt = sp->wt + b->toff[first];
+    f64_t len = b->tlen[first],
+          smp_inc = b->freq[first]/(sp->sr/len),
+          smp_cur = b->phs[first];
+    for (n = 0; n < nsamps; n++) {
+        size_t cur_smp = (size_t)smp_cur;
+        if (lerp) {
+            f64_t diff = smp_cur - cur_smp;
+            f64_t ydiff = wt[cur_smp + 1] - wt[cur_smp];
+            out[n] += (wt[cur_smp] + ydiff*diff) * gain[n];
+        } else {
+            out[n] += wt[cur_smp] * gain[n];
+        }
+        smp_cur += smp_inc;
+        if ((smp_cur < 0) || (smp_cur >= len)) {
+            /* however far it went, so a bad increment can't read outside
+             * the table */
+            smp_cur -= floorf(smp_cur / len) * len;
+            if (!((smp_cur >= 0) && (smp_cur < len))) {
+                smp_cur = 0;
+            }
+        }
+    }
+    b->phs[first] = smp_cur;
+}
+KERN_PAIR(kern_scalar,)
+
+/* Sums w values by halves, the order the vector kernels reduce in */
+static inline f64_t lane_sum(f64_t *x, size_t w)
+{
+    size_t h, i;
+    for (h = w / 2; h; h /= 2) {
+        for (i = 0; i < h; i++) {
+            x[i] += x[i + h];
+        }
+    }
+    return x[0];
+}
+
+/* Fixed point phase, any width. The fraction is the 24 bits below the table
+ * index so it has at least the precision of the float phase. */
+KERN_BODY
+void kern_fixed_body(synth_bank_t *b, synth_vc_proc_t *sp, size_t first,
+                     synth_bank_scratch_t *sc, f64_t *out, size_t nsamps,
+                     int lerp)
+{
+    const f64_t *gain = sc->gain;
+    size_t n, l, w = b->width;
+    for (l = 0; l < w; l++) {
+        const f64_t *wt = sp->wt + b->toff[first + l];
+        uint32_t acc = b->acc[first + l],
+                 inc = b->acc_inc[first + l],
+                 sh = b->tshift[first + l];
+        for (n = 0; n < nsamps; n++) {
+            uint32_t idx = sh < 32 ? acc >> sh : 0,
+                     frc = (uint32_t)((uint64_t)acc << (32 - sh)) >> 8;
+            f64_t frac = (f64_t)(int32_t)frc * (1.f / (1 << 24)),
+                  y0 = wt[idx];
+            f64_t smp = lerp ? y0 + (wt[idx + 1] - y0) * frac : y0;
+            /* same order of sums over the lanes as the vector kernels */
+            sc->lane[n*w + l] = smp * gain[n*w + l];
+            acc += inc;
+        }
+        b->acc[first + l] = acc;
+    }
+    for (n = 0; n < nsamps; n++) {
+        out[n] += lane_sum(sc->lane + n*w,w);
+    }
+}
+KERN_PAIR(kern_fixed,)
+
+#ifdef SYNTH_BANK_X86
+
+/* SSE2 has no gather so the table reads are done lane by lane */
+KERN_BODY __attribute__((target("sse2")))
+void kern_sse_body(synth_bank_t *b, synth_vc_proc_t *sp, size_t first,
+                   synth_bank_scratch_t *sc, f64_t *out, size_t nsamps,
+                   int lerp)
+{
+    const f64_t *gain = sc->gain;
+    size_t n;
+    int32_t i0[4] __attribute__((aligned(16)));
+    const f64_t *wt = sp->wt;
+    __m128 len = _mm_load_ps(b->tlen + first),
+           zero = _mm_setzero_ps(),
+           inc = _mm_div_ps(_mm_load_ps(b->freq + first),
+                            _mm_div_ps(_mm_set1_ps(sp->sr),len)),
+           phs = _mm_load_ps(b->phs + first);
+    __m128i off = _mm_load_si128((__m128i*)(b->toff + first));
+    for (n = 0; n < nsamps; n++) {
+        __m128i idx = _mm_cvttps_epi32(phs);
+        _mm_store_si128((__m128i*)i0,_mm_add_epi32(idx,off));
+        __m128 y0 = _mm_set_ps(wt[i0[3]],wt[i0[2]],wt[i0[1]],wt[i0[0]]),
+               smp = y0;
+        if (lerp) {
+            __m128 frac = _mm_sub_ps(phs,_mm_cvtepi32_ps(idx)),
+                   y1 = _mm_set_ps(wt[i0[3]+1],wt[i0[2]+1],wt[i0[1]+1],wt[i0[0]+1]);
+            smp = _mm_add_ps(y0,_mm_mul_ps(_mm_sub_ps(y1,y0),frac));
+        }
+        __m128 acc = _mm_mul_ps(smp,_mm_load_ps(gain + n*4));
+        acc = _mm_add_ps(acc,_mm_movehl_ps(acc,acc));
+        acc = _mm_add_ss(acc,_mm_shuffle_ps(acc,acc,1));
+        out[n] += _mm_cvtss_f32(acc);
+        phs = _mm_add_ps(phs,inc);
+        phs = _mm_add_ps(phs,_mm_and_ps(_mm_cmplt_ps(phs,zero),len));
+        phs = _mm_sub_ps(phs,_mm_and_ps(_mm_cmpge_ps(phs,len),len));
+    }
+    _mm_store_ps(b->phs + first,phs);
+}
+KERN_PAIR(kern_sse,__attribute__((target("sse2"))))
+
+KERN_BODY __attribute__((target("avx2")))
+void kern_avx2_body(synth_bank_t *b, synth_vc_proc_t *sp, size_t first,
+                    synth_bank_scratch_t *sc, f64_t *out, size_t nsamps,
+                    int lerp)
+{
+    const f64_t *gain = sc->gain;
+    size_t n;
+    const f64_t *wt = sp->wt;
+    __m256 len = _mm256_load_ps(b->tlen + first),
+           zero = _mm256_setzero_ps(),
+           inc = _mm256_div_ps(_mm256_load_ps(b->freq + first),
+                               _mm256_div_ps(_mm256_set1_ps(sp->sr),len)),
+           phs = _mm256_load_ps(b->phs + first);
+    __m256i off = _mm256_load_si256((__m256i*)(b->toff + first));
+    for (n = 0; n < nsamps; n++) {
+        __m256i idx = _mm256_cvttps_epi32(phs),
+                pos = _mm256_add_epi32(idx,off);
+        __m256 y0 = _mm256_i32gather_ps(wt,pos,4),
+               smp = y0;
+        if (lerp) {
+            __m256 frac = _mm256_sub_ps(phs,_mm256_cvtepi32_ps(idx)),
+                   y1 = _mm256_i32gather_ps(wt + 1,pos,4);
+            smp = _mm256_add_ps(y0,_mm256_mul_ps(_mm256_sub_ps(y1,y0),frac));
+        }
+        __m256 acc8 = _mm256_mul_ps(smp,_mm256_load_ps(gain + n*8));
+        __m128 acc = _mm_add_ps(_mm256_castps256_ps128(acc8),
+                                _mm256_extractf128_ps(acc8,1));
+        acc = _mm_add_ps(acc,_mm_movehl_ps(acc,acc));
+        acc = _mm_add_ss(acc,_mm_shuffle_ps(acc,acc,1));
+        out[n] += _mm_cvtss_f32(acc);
+        phs = _mm256_add_ps(phs,inc);
+        phs = _mm256_add_ps(phs,_mm256_and_ps(_mm256_cmp_ps(phs,zero,_CMP_LT_OQ),len));
+        phs = _mm256_sub_ps(phs,_mm256_and_ps(_mm256_cmp_ps(phs,len,_CMP_GE_OQ),len));
+    }
+    _mm256_store_ps(b->phs + first,phs);
+}
+KERN_PAIR(kern_avx2,__attribute__((target("avx2"))))
+
+KERN_BODY __attribute__((target("avx512f")))
+void kern_avx512_body(synth_bank_t *b, synth_vc_proc_t *sp, size_t first,
+                      synth_bank_scratch_t *sc, f64_t *out, size_t nsamps,
+                      int lerp)
+{
+    const f64_t *gain = sc->gain;
+    size_t n;
+    const f64_t *wt = sp->wt;
+    __m512 len = _mm512_load_ps(b->tlen + first),
+           zero = _mm512_setzero_ps(),
+           inc = _mm512_div_ps(_mm512_load_ps(b->freq + first),
+                               _mm512_div_ps(_mm512_set1_ps(sp->sr),len)),
+           phs = _mm512_load_ps(b->phs + first);
+    __m512i off = _mm512_load_si512(b->toff + first);
+    for (n = 0; n < nsamps; n++) {
+        __m512i idx = _mm512_cvttps_epi32(phs),
+                pos = _mm512_add_epi32(idx,off);
+        __m512 y0 = _mm512_i32gather_ps(pos,wt,4),
+               smp = y0;
+        if (lerp) {
+            __m512 frac = _mm512_sub_ps(phs,_mm512_cvtepi32_ps(idx)),
+                   y1 = _mm512_i32gather_ps(pos,wt + 1,4);
+            smp = _mm512_add_ps(y0,_mm512_mul_ps(_mm512_sub_ps(y1,y0),frac));
+        }
+        out[n] += _mm512_reduce_add_ps(_mm512_mul_ps(smp,_mm512_load_ps(gain + n*16)));
+        phs = _mm512_add_ps(phs,inc);
+        phs = _mm512_mask_add_ps(phs,_mm512_cmp_ps_mask(phs,zero,_CMP_LT_OQ),phs,len);
+        phs = _mm512_mask_sub_ps(phs,_mm512_cmp_ps_mask(phs,len,_CMP_GE_OQ),phs,len);
+    }
+    _mm512_store_ps(b->phs + first,phs);
+}
+KERN_PAIR(kern_avx512,__attribute__((target("avx512f"))))
+
+KERN_BODY __attribute__((target("avx2")))
+void kern_fixed_avx2_body(synth_bank_t *b, synth_vc_proc_t *sp, size_t first,
+                          synth_bank_scratch_t *sc, f64_t *out, size_t nsamps,
+                          int lerp)
+{
+    const f64_t *gain = sc->gain;
+    size_t n;
+    const f64_t *wt = sp->wt;
+    __m256i acc = _mm256_load_si256((__m256i*)(b->acc + first)),
+            inc = _mm256_load_si256((__m256i*)(b->acc_inc + first)),
+            sh = _mm256_load_si256((__m256i*)(b->tshift + first)),
+            fsh = _mm256_sub_epi32(_mm256_set1_epi32(32),sh),
+            off = _mm256_load_si256((__m256i*)(b->toff + first));
+    __m256 scale = _mm256_set1_ps(1.f / (1 << 24));
+    for (n = 0; n < nsamps; n++) {
+        /* shifts of 32 or more give 0, as wanted for idle voices */
+        __m256i pos = _mm256_add_epi32(_mm256_srlv_epi32(acc,sh),off);
+        __m256 y0 = _mm256_i32gather_ps(wt,pos,4),
+               smp = y0;
+        if (lerp) {
+            __m256i frc = _mm256_srli_epi32(_mm256_sllv_epi32(acc,fsh),8);
+            __m256 frac = _mm256_mul_ps(_mm256_cvtepi32_ps(frc),scale),
+                   y1 = _mm256_i32gather_ps(wt + 1,pos,4);
+            smp = _mm256_add_ps(y0,_mm256_mul_ps(_mm256_sub_ps(y1,y0),frac));
+        }
+        __m256 acc8 = _mm256_mul_ps(smp,_mm256_load_ps(gain + n*8));
+        __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc8),
+                                _mm256_extractf128_ps(acc8,1));
+        sum = _mm_add_ps(sum,_mm_movehl_ps(sum,sum));
+        sum = _mm_add_ss(sum,_mm_shuffle_ps(sum,sum,1));
+        out[n] += _mm_cvtss_f32(sum);
+        acc = _mm256_add_epi32(acc,inc);
+    }
+    _mm256_store_si256((__m256i*)(b->acc + first),acc);
+}
+KERN_PAIR(kern_fixed_avx2,__attribute__((target("avx2"))))
+
+KERN_BODY __attribute__((target("avx512f")))
+void kern_fixed_avx512_body(synth_bank_t *b, synth_vc_proc_t *sp, size_t first,
+                            synth_bank_scratch_t *sc, f64_t *out, size_t nsamps,
+                            int lerp)
+{
+    const f64_t *gain = sc->gain;
+    size_t n;
+    const f64_t *wt = sp->wt;
+    __m512i acc = _mm512_load_si512(b->acc + first),
+            inc = _mm512_load_si512(b->acc_inc + first),
+            sh = _mm512_load_si512(b->tshift + first),
+            fsh = _mm512_sub_epi32(_mm512_set1_epi32(32),sh),
+            off = _mm512_load_si512(b->toff + first);
+    __m512 scale = _mm512_set1_ps(1.f / (1 << 24));
+    for (n = 0; n < nsamps; n++) {
+        __m512i pos = _mm512_add_epi32(_mm512_srlv_epi32(acc,sh),off);
+        __m512 y0 = _mm512_i32gather_ps(pos,wt,4),
+               smp = y0;
+        if (lerp) {
+            __m512i frc = _mm512_srli_epi32(_mm512_sllv_epi32(acc,fsh),8);
+            __m512 frac = _mm512_mul_ps(_mm512_cvtepi32_ps(frc),scale),
+                   y1 = _mm512_i32gather_ps(pos,wt + 1,4);
+            smp = _mm512_add_ps(y0,_mm512_mul_ps(_mm512_sub_ps(y1,y0),frac));
+        }
+        out[n] += _mm512_reduce_add_ps(_mm512_mul_ps(smp,_mm512_load_ps(gain + n*16)));
+        acc = _mm512_add_epi32(acc,inc);
+    }
+    _mm512_store_si512(b->acc + first,acc);
+}
+KERN_PAIR(kern_fixed_avx512,__attribute__((target("avx512f"))))
+
+#endif /* SYNTH_BANK_X86 */
+
+static synth_bank_isa_t detect_isa(void)
+{
+#ifdef SYNTH_BANK_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return synth_bank_isa_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return synth_bank_isa_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return synth_bank_isa_SSE;
+    }
+#endif
+    return synth_bank_isa_SCALAR;
+}
+
+const char *synth_bank_isa_name(synth_bank_isa_t isa)
+{
+    switch (isa) {
+        case synth_bank_isa_SCALAR: return "scalar";
+        case synth_bank_isa_SSE: return "sse2";
+        case synth_bank_isa_AVX2: return "avx2";
+        case synth_bank_isa_AVX512: return "avx512f";
+        default: return "auto";
+    }
+}
+
+/* Idle voices keep a finished envelope, so their gain is 0 in every kernel,
+ * and a zero phase so their table index stays in range. */
+static void voice_idle(synth_bank_t *b, size_t v)
+{
+    b->freq[v] = 0;
+    b->phs[v] = 0;
+    b->toff[v] = 0;
+    b->tlen[v] = 1;
+    b->acc[v] = 0;
+    b->acc_inc[v] = 0;
+    b->tshift[v] = 32;
+    env_end(&b->env[v]);
+}
+
+static inline size_t hash_home(synth_bank_t *b, f64_t freq)
+{
+    union { f64_t f; uint32_t u; } x = { .f = freq };
+    return (size_t)((x.u * 2654435761u) >> 7) & b->_hmask;
+}
+
+/* Returns the position in the hash table holding slot v */
+static size_t hash_pos(synth_bank_t *b, size_t v)
+{
+    size_t h = hash_home(b,b->freq[v]);
+    while (b->_hash[h] != (int32_t)v) {
+        h = (h + 1) & b->_hmask;
+    }
+    return h;
+}
+
+/* Returns the voice of group playing frequency freq or -1 */
+static int32_t hash_find(synth_bank_t *b, f64_t freq, uint32_t group)
+{
+    size_t h = hash_home(b,freq);
+    while (b->_hash[h] >= 0) {
+        if ((b->freq[b->_hash[h]] == freq) && (b->group[b->_hash[h]] == group)) {
+            return b->_hash[h];
+        }
+        h = (h + 1) & b->_hmask;
+    }
+    return -1;
+}
+
+static void hash_insert(synth_bank_t *b, size_t v)
+{
+    size_t h = hash_home(b,b->freq[v]);
+    while (b->_hash[h] >= 0) {
+        h = (h + 1) & b->_hmask;
+    }
+    b->_hash[h] = v;
+}
+
+/* Removes slot v, shifting back entries that probed past it so lookups
+ * never stop early */
+static void hash_remove(synth_bank_t *b, size_t v)
+{
+    size_t i = hash_pos(b,v), j = i;
+    for (;;) {
+        j = (j + 1) & b->_hmask;
+        if (b->_hash[j] < 0) {
+            break;
+        }
+        size_t k = hash_home(b,b->freq[b->_hash[j]]);
+        /* move the entry at j to i unless its home lies cyclically in (i,j] */
+        if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j))) {
+            continue;
+        }
+        b->_hash[i] = b->_hash[j];
+        i = j;
+    }
+    b->_hash[i] = -1;
+}
+
+/* Ends voice v by moving the last active voice into its slot */
+static void voice_remove(synth_bank_t *b, size_t v)
+{
+    size_t last = b->nactive - 1;
+    hash_remove(b,v);
+    b->group_n[b->group[v]]--;
+    if (v != last) {
+        b->_hash[hash_pos(b,last)] = v;
+        b->freq[v] = b->freq[last];
+        b->phs[v] = b->phs[last];
+        b->toff[v] = b->toff[last];
+        b->tlen[v] = b->tlen[last];
+        b->acc[v] = b->acc[last];
+        b->acc_inc[v] = b->acc_inc[last];
+        b->tshift[v] = b->tshift[last];
+        b->env[v] = b->env[last];
+        b->start[v] = b->start[last];
+        b->group[v] = b->group[last];
+    }
+    voice_idle(b,last);
+    b->nactive--;
+}
+
+/* Returns the voice of group that policy how would end first, or of any
+ * group if group is negative, or -1. This scans the active list: the
+ * quietest voice changes every block, so no order is kept for it. */
+static int32_t pick_voice(synth_bank_t *b, synth_bank_steal_t how, int32_t group)
+{
+    int32_t ret = -1;
+    size_t v;
+    f64_t lvl, min_lvl = 0;
+#define CAN_STEAL(v) ((group < 0) || (b->group[v] == (uint32_t)group))
+    switch (how) {
+        case synth_bank_steal_OLDEST:
+            for (v = 0; v < b->nactive; v++) {
+                if (CAN_STEAL(v) && ((ret < 0) || (b->start[v] < b->start[ret]))) {
+                    ret = v;
+                }
+            }
+            break;
+        case synth_bank_steal_QUIETEST:
+            for (v = 0; v < b->nactive; v++) {
+                if (!CAN_STEAL(v)) {
+                    continue;
+                }
+                /* a voice waiting for its onset is about to get loud */
+                lvl = b->env[v]._seg == env_seg_IDLE ?
+                    b->env[v].max_amp : b->env[v]._lvl;
+                lvl = lvl < 0 ? -lvl : lvl;
+                if ((ret < 0) || (lvl < min_lvl)) {
+                    ret = v;
+                    min_lvl = lvl;
+                }
+            }
+            break;
+        case synth_bank_steal_RELEASE:
+            for (v = 0; v < b->nactive; v++) {
+                if (CAN_STEAL(v) && (b->env[v]._seg >= env_seg_REL)
+                        && ((ret < 0) || (b->start[v] < b->start[ret]))) {
+                    ret = v;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+#undef CAN_STEAL
+    return ret;
+}
+
+/* Returns the slot to take for a new note of group when all are playing or
+ * the group has used its budget, or -1. In the latter case only the
+ * group's own voices are taken. */
+static int32_t steal_victim(synth_bank_t *b, uint32_t group)
+{
+    int own = b->group_n[group] >= b->group_max[group];
+    return pick_voice(b,b->steal,own ? (int32_t)group : -1);
+}
+
+/* Returns the next SYNTH_BANK_ALIGN aligned chunk of size bytes from *mem */
+static void *carve(char **mem, size_t size)
+{
+    void *ret = *mem;
+    *mem += (size + SYNTH_BANK_ALIGN - 1) / SYNTH_BANK_ALIGN * SYNTH_BANK_ALIGN;
+    return ret;
+}
+
+#define BANK_NARRAYS 14
+
+/* Fills in the voices, rounded up to whole kernel calls, the hash size
+ * and the size of each array of a bank made by sbi, and returns the bytes
+ * they take up together */
+static size_t bank_sizes(synth_bank_init_t *sbi, size_t *nvoices, size_t *hsize,
+                         size_t sizes[BANK_NARRAYS])
+{
+    size_t nv = (sbi->nvoices + SYNTH_BANK_MAX_LANES - 1)
+        / SYNTH_BANK_MAX_LANES * SYNTH_BANK_MAX_LANES, hs = 1, n, memsz = 0;
+    if (nv == 0) {
+        nv = SYNTH_BANK_MAX_LANES;
+    }
+    /* at most half full so probes stay short */
+    while (hs < 2 * nv) {
+        hs <<= 1;
+    }
+    size_t s[BANK_NARRAYS] = {
+        nv * sizeof(f64_t),
+        nv * sizeof(f64_t),
+        nv * sizeof(env_t),
+        sizeof(synth_bank_scratch_t),
+        nv * sizeof(uint64_t),
+        hs * sizeof(int32_t),
+        nv * sizeof(int32_t),
+        nv * sizeof(f64_t),
+        nv * sizeof(uint32_t),
+        nv * sizeof(uint32_t),
+        nv * sizeof(uint32_t),
+        nv * sizeof(uint32_t),
+        sbi->ngroups * sizeof(size_t),
+        sbi->ngroups * sizeof(size_t)
+    };
+    for (n = 0; n < BANK_NARRAYS; n++) {
+        sizes[n] = s[n];
+        memsz += (s[n] + SYNTH_BANK_ALIGN - 1) / SYNTH_BANK_ALIGN * SYNTH_BANK_ALIGN;
+    }
+    *nvoices = nv;
+    *hsize = hs;
+    return memsz;
+}
+
+size_t synth_bank_mem_size(synth_bank_init_t *sbi)
+{
+    size_t nvoices, hsize, sizes[BANK_NARRAYS];
+    return arena_size(bank_sizes(sbi,&nvoices,&hsize,sizes));
+}
+
+/* Takes synth_bank_mem_size(sbi) bytes from sbi->arena */
+err_t synth_bank_init(synth_bank_t *b, synth_bank_init_t *sbi)
+{
+    size_t nvoices, hsize, sizes[BANK_NARRAYS], n, memsz;
+    synth_bank_isa_t isa = sbi->isa,
+                     have = detect_isa();
+    if (isa == synth_bank_isa_AUTO) {
+        isa = have;
+    }
+    if ((isa > have) || (sbi->phase > synth_bank_phase_FIXED)
+            || (sbi->ngroups == 0) || (sbi->ngroups > UINT32_MAX)) {
+        return err_EINVAL;
+    }
+    _MZ(b,synth_bank_t,1);
+    memsz = bank_sizes(sbi,&nvoices,&hsize,sizes);
+    char *mem = arena_alloc(sbi->arena,memsz);
+    if (!mem) {
+        return err_MEM;
+    }
+    b->_arena = sbi->arena;
+    b->_mem = mem;
+    b->freq = carve(&mem,sizes[0]);
+    b->phs = carve(&mem,sizes[1]);
+    b->env = carve(&mem,sizes[2]);
+    b->_scratch = carve(&mem,sizes[3]);
+    b->start = carve(&mem,sizes[4]);
+    b->_hash = carve(&mem,sizes[5]);
+    b->toff = carve(&mem,sizes[6]);
+    b->tlen = carve(&mem,sizes[7]);
+    b->acc = carve(&mem,sizes[8]);
+    b->acc_inc = carve(&mem,sizes[9]);
+    b->tshift = carve(&mem,sizes[10]);
+    b->group = carve(&mem,sizes[11]);
+    b->group_n = carve(&mem,sizes[12]);
+    b->group_max = carve(&mem,sizes[13]);
+    b->ngroups = sbi->ngroups;
+    for (n = 0; n < b->ngroups; n++) {
+        b->group_max[n] = nvoices;
+    }
+    b->_hmask = hsize - 1;
+    b->nvoices = nvoices;
+    b->isa = isa;
+    b->steal = sbi->steal;
+    b->phase = sbi->phase;
+    int fixed = b->phase == synth_bank_phase_FIXED;
+    switch (isa) {
+#ifdef SYNTH_BANK_X86
+        case synth_bank_isa_SSE:
+            /* without variable shifts the fixed kernel is no faster in
+             * SSE2 than in C */
+            b->_kern = fixed ? kern_fixed : kern_sse;
+            b->_kern_near = fixed ? kern_fixed_near : kern_sse_near;
+            b->width = 4;
+            break;
+        case synth_bank_isa_AVX2:
+            b->_kern = fixed ? kern_fixed_avx2 : kern_avx2;
+            b->_kern_near = fixed ? kern_fixed_avx2_near : kern_avx2_near;
+            b->width = 8;
+            break;
+        case synth_bank_isa_AVX512:
+            b->_kern = fixed ? kern_fixed_avx512 : kern_avx512;
+            b->_kern_near = fixed ? kern_fixed_avx512_near : kern_avx512_near;
+            b->width = 16;
+            break;
+#endif
+        default:
+            b->_kern = fixed ? kern_fixed : kern_scalar;
+            b->_kern_near = fixed ? kern_fixed_near : kern_scalar_near;
+            b->width = 1;
+            break;
+    }
+    for (n = 0; n < nvoices; n++) {
+        voice_idle(b,n);
+    }
+    for (n = 0; n < hsize; n++) {
+        b->_hash[n] = -1;
+    }
+    return err_NONE;
+}
+
+void synth_bank_destroy(synth_bank_t *b)
+{
+    arena_free(b->_arena,b->_mem);
+    _MZ(b,synth_bank_t,1);
+}
+
+/* Sets the most voices group starts before it steals from itself. Voices
+ * it already has over a lowered budget play out. */
+void synth_bank_set_budget(synth_bank_t *b, size_t group, size_t nvoices)
+{
+    if (group < b->ngroups) {
+        b->group_max[group] = nvoices;
+    }
+}
+
+err_t synth_bank_add(synth_bank_t *b, synth_vc_proc_t *sp,
+                     synth_vc_init_t *svi, size_t delay)
+{
+    return synth_bank_add_group(b,sp,svi,delay,0);
+}
+
+/* Starts a voice of group delay samples into the next block rendered. The
+ * group's voice already playing the same frequency is restarted, otherwise
+ * a free one is taken or, if none is free or the group is at its budget,
+ * one is stolen as the steal policy says. Returns err_FULL, and counts the
+ * note as dropped, if there is no voice for it, and err_EINVAL if group is
+ * out of range, the frequency is not in (0, sr/2) or the table length is
+ * not a power of 2 in FIXED mode. */
+err_t synth_bank_add_group(synth_bank_t *b, synth_vc_proc_t *sp,
+                           synth_vc_init_t *svi, size_t delay, size_t group)
+{
+    /* a voice advances less than half its table a sample, so the kernels
+     * only ever wrap its phase once */
+    if ((group >= b->ngroups) || !isfinite(svi->freq) || !(svi->freq > 0)
+            || !(svi->freq < sp->sr / 2)) {
+        return err_EINVAL;
+    }
+    env_t env;
+    err_t err = env_init(&env,
+                         svi->a,
+                         svi->d,
+                         svi->s,
+                         svi->r,
+                         svi->max_amp,
+                         svi->sus_amp,
+                         svi->curve);
+    if (err != err_NONE) {
+        return err;
+    }
+    size_t toff = 0, tlen = sp->len;
+    if (sp->set) {
+        const wtset_lvl_t *lvl = &sp->set->lvl[wtset_level(sp->set,svi->freq)];
+        toff = lvl->off;
+        tlen = lvl->len;
+    }
+    uint32_t tbits = 0;
+    while (((size_t)1 << tbits) < tlen) {
+        tbits++;
+    }
+    if ((b->phase == synth_bank_phase_FIXED)
+            && ((tlen != ((size_t)1 << tbits)) || (tbits > 24))) {
+        return err_EINVAL;
+    }
+    int32_t v = hash_find(b,svi->freq,group);
+    if (v >= 0) {
+        b->n_retrig++;
+    } else {
+        if ((b->nactive < b->nvoices)
+                && (b->group_n[group] < b->group_max[group])) {
+            v = b->nactive++;
+        } else if ((v = steal_victim(b,group)) >= 0) {
+            hash_remove(b,v);
+            b->group_n[b->group[v]]--;
+            b->n_stolen++;
+        } else {
+            b->n_dropped++;
+            return err_FULL;
+        }
+        b->freq[v] = svi->freq;
+        b->group[v] = group;
+        b->group_n[group]++;
+        hash_insert(b,v);
+    }
+    b->env[v] = env;
+    env_delay(&b->env[v],delay);
+    b->toff[v] = toff;
+    b->tlen[v] = tlen;
+    /* start the phase back so that it is 0 on the first audible sample */
+    f64_t len = (f64_t)tlen,
+          phs = fmod(-((double)svi->freq * tlen / sp->sr) * delay,len);
+    if (phs < 0) {
+        phs += len;
+    }
+    if (phs >= len) {
+        phs = 0;
+    }
+    b->phs[v] = phs;
+    /* the same start in whole periods, exactly 0 at the onset */
+    b->acc_inc[v] = (uint32_t)llrint((double)svi->freq / sp->sr * 4294967296.);
+    b->acc[v] = 0u - b->acc_inc[v] * (uint32_t)delay;
+    b->tshift[v] = 32 - tbits;
+    b->start[v] = b->_clock++;
+    return err_NONE;
+}
+
+/* Adds the output of voices [first, last) to out, without ending any whose
+ * envelope finishes. first must be a multiple of SYNTH_BANK_MAX_LANES.
+ * Ranges that don't overlap can be rendered at the same time by different
+ * threads, each with its own sc, as long as synth_bank_reap waits until
+ * all have finished. */
+void synth_bank_proc_range(synth_bank_t *b, synth_vc_proc_t *sp,
+                           synth_bank_scratch_t *sc, f64_t *out,
+                           size_t nsamps, size_t first, size_t last)
+{
+    size_t v, l, w = b->width;
+    for (v = first; v < last; v += w) {
+        size_t done = 0;
+        int live = 1;
+        while (live && (done < nsamps)) {
+            size_t k = nsamps - done < SYNTH_BANK_BLOCK ?
+                nsamps - done : SYNTH_BANK_BLOCK;
+            live = 0;
+            for (l = 0; l < w; l++) {
+                env_proc(&b->env[v + l],sp->sr,sc->gain + l,w,k);
+                live |= !env_done(&b->env[v + l]);
+            }
+            (b->nearest ? b->_kern_near : b->_kern)(b,sp,v,sc,out + done,k);
+            done += k;
+        }
+    }
+}
+
+/* Ends the voices whose envelopes have finished, or will stay below
+ * sp->cull until they do */
+void synth_bank_reap(synth_bank_t *b, synth_vc_proc_t *sp)
+{
+    size_t v;
+    /* walk down so a voice moved into a freed slot has already been seen */
+    for (v = b->nactive; v-- > 0;) {
+        env_t *e = &b->env[v];
+        size_t left;
+        if (env_done(e)) {
+            voice_remove(b,v);
+        } else if (env_peak(e) <= sp->cull) {
+            /* one with nothing left was done anyway */
+            if ((left = env_left(e,sp->sr))) {
+                b->n_culled++;
+                b->n_culled_samps += left;
+            }
+            voice_remove(b,v);
+        }
+    }
+}
+
+/* Ends up to n playing voices, of any group, chosen by policy how as if
+ * each were stolen, so it costs O(n * nactive). Returns how many were
+ * ended. */
+size_t synth_bank_shed(synth_bank_t *b, size_t n, synth_bank_steal_t how)
+{
+    size_t k;
+    int32_t v;
+    for (k = 0; k < n; k++) {
+        if ((v = pick_voice(b,how,-1)) < 0) {
+            break;
+        }
+        voice_remove(b,v);
+    }
+    return k;
+}
+
+/* Adds the output of all playing voices to out. */
+err_t synth_bank_proc(synth_bank_t *b, synth_vc_proc_t *sp, f64_t *out, size_t nsamps)
+{
+    synth_bank_proc_range(b,sp,b->_scratch,out,nsamps,0,b->nactive);
+    synth_bank_reap(b,sp);
+    return err_NONE;
+}
@@ -0,0 +1,147 @@
+#ifndef SYNTH_BANK_H
+#define SYNTH_BANK_H
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "synth.h"
+#include "env.h"
+#include "arena.h"
+#include <stdint.h>
+
+/* A bank of voices stored as structure-of-arrays so that several voices can
+ * be rendered at once, one voice per SIMD lane. The kernel is chosen at
+ * runtime from what the CPU supports.
+ * Playing voices are kept packed in slots [0, nactive), which is the active
+ * list, and the slots above form the free stack. Starting a voice while one
+ * is free, or ending one, is O(1) and rendering costs O(nactive). Stealing
+ * scans the active list, so a note that has to steal costs O(nactive). */
+
+/* Voice count is rounded up to a multiple of this so any kernel width fits */
+#define SYNTH_BANK_MAX_LANES 16
+#define SYNTH_BANK_ALIGN 64
+/* Number of envelope gains computed at a time for each voice */
+#define SYNTH_BANK_BLOCK 64
+
+typedef enum synth_bank_isa_t {
+    synth_bank_isa_AUTO,
+    synth_bank_isa_SCALAR,
+    synth_bank_isa_SSE,
+    synth_bank_isa_AVX2,
+    synth_bank_isa_AVX512
+} synth_bank_isa_t;
+
+/* Which voice to take for a new note when none is free */
+typedef enum synth_bank_steal_t {
+    synth_bank_steal_NONE,     /* drop the new note */
+    synth_bank_steal_OLDEST,
+    synth_bank_steal_QUIETEST,
+    synth_bank_steal_RELEASE   /* oldest voice in its release, else drop */
+} synth_bank_steal_t;
+
+/* How voice phases are kept. FIXED keeps a 32-bit integer phase per voice
+ * whose top bits index the table and low bits give the interpolation
+ * fraction. Its pitch is exact to within sr/2^32 Hz however long a note
+ * lasts, but it needs every table length to be a power of 2. */
+typedef enum synth_bank_phase_t {
+    synth_bank_phase_FLOAT,
+    synth_bank_phase_FIXED
+} synth_bank_phase_t;
+
+typedef struct synth_bank_init_t {
+    size_t nvoices;
+    synth_bank_isa_t isa;
+    synth_bank_steal_t steal;
+    synth_bank_phase_t phase;
+    size_t ngroups; /* that voices can be budgeted between */
+    arena_t *arena; /* to take memory from, NULL for the heap */
+} synth_bank_init_t;
+
+#define SYNTH_BANK_INIT_DEFAULT (synth_bank_init_t) { \
+    .nvoices = 16, \
+    .isa = synth_bank_isa_AUTO, \
+    .steal = synth_bank_steal_OLDEST, \
+    .phase = synth_bank_phase_FLOAT, \
+    .ngroups = 1, \
+    .arena = NULL \
+}
+
+/* Working memory for rendering a group of voices. Each thread rendering
+ * part of a bank needs its own. */
+typedef struct synth_bank_scratch_t {
+    /* envelope gains, the gain of sample n of voice first+l at
+     * [n*width + l] */
+    f64_t gain[SYNTH_BANK_MAX_LANES * SYNTH_BANK_BLOCK];
+    f64_t lane[SYNTH_BANK_MAX_LANES * SYNTH_BANK_BLOCK]; /* for kern_fixed */
+} __attribute__((aligned(SYNTH_BANK_ALIGN))) synth_bank_scratch_t;
+
+struct synth_bank_t;
+
+typedef void (*synth_bank_kern_t)(struct synth_bank_t *b,
+                                  synth_vc_proc_t *sp,
+                                  size_t first,
+                                  synth_bank_scratch_t *sc,
+                                  f64_t *out,
+                                  size_t nsamps);
+
+typedef struct synth_bank_t {
+    size_t nvoices; /* capacity, a multiple of SYNTH_BANK_MAX_LANES */
+    size_t nactive; /* playing voices, in slots [0, nactive) */
+    f64_t *freq;
+    f64_t *phs;     /* current phase in samples of the voice's table */
+    uint32_t *acc;  /* current phase as a fraction of 2^32 (FIXED) */
+    uint32_t *acc_inc;
+    uint32_t *tshift; /* acc >> tshift is the table index (FIXED) */
+    int32_t *toff;  /* where the voice's table starts in the wavetable */
+    f64_t *tlen;    /* and its length */
+    env_t *env;
+    uint64_t *start; /* order in which voices were started, for stealing */
+    /* Each voice belongs to the group that started it. A group with as
+     * many voices as its budget only steals from itself. */
+    uint32_t *group;
+    size_t ngroups;
+    size_t *group_n;
+    size_t *group_max;
+    synth_bank_steal_t steal;
+    synth_bank_phase_t phase;
+    /* notes dropped for lack of a voice, voices stolen and voices reused
+     * by a note of the same frequency */
+    size_t n_dropped;
+    size_t n_stolen;
+    size_t n_retrig;
+    /* voices ended early for being too quiet to hear (see synth_vc_proc_t),
+     * and the samples they would still have been rendered for */
+    size_t n_culled;
+    size_t n_culled_samps;
+    synth_bank_scratch_t *_scratch; /* for synth_bank_proc */
+    synth_bank_isa_t isa;
+    size_t width;   /* voices per kernel call */
+    /* read the table sample below each voice's phase rather than
+     * interpolating, which is cheaper but adds noise */
+    int nearest;
+    synth_bank_kern_t _kern;
+    synth_bank_kern_t _kern_near;
+    int32_t *_hash;  /* frequency -> slot of the playing voices, -1 if empty */
+    size_t _hmask;
+    uint64_t _clock;
+    void *_mem;
+    arena_t *_arena;
+} synth_bank_t;
+
+err_t synth_bank_init(synth_bank_t *b, synth_bank_init_t *sbi);
+size_t synth_bank_mem_size(synth_bank_init_t *sbi);
+void synth_bank_destroy(synth_bank_t *b);
+err_t synth_bank_add(synth_bank_t *b, synth_vc_proc_t *sp,
+                     synth_vc_init_t *svi, size_t delay);
+err_t synth_bank_add_group(synth_bank_t *b, synth_vc_proc_t *sp,
+                           synth_vc_init_t *svi, size_t delay, size_t group);
+void synth_bank_set_budget(synth_bank_t *b, size_t group, size_t nvoices);
+err_t synth_bank_proc(synth_bank_t *b, synth_vc_proc_t *sp, f64_t *out, size_t nsamps);
+void synth_bank_proc_range(synth_bank_t *b, synth_vc_proc_t *sp,
+                           synth_bank_scratch_t *sc, f64_t *out,
+                           size_t nsamps, size_t first, size_t last);
+void synth_bank_reap(synth_bank_t *b, synth_vc_proc_t *sp);
+size_t synth_bank_shed(synth_bank_t *b, size_t n, synth_bank_steal_t how);
+const char *synth_bank_isa_name(synth_bank_isa_t isa);
+
+#endif /* SYNTH_BANK_H */
@@ -0,0 +1,484 @@
+/* Benchmarks of the synth, sequencer and scheduler hot paths. Results are
+ * written to stdout as JSON so they can be compared between releases. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "defs.h"
+#include "types.h"
+#include "synth.h"
+#include "synth_bank.h"
+#include "seq.h"
+#include "engine.h"
+#include "proto.h"
+
+#define BENCH_SR 48000
+
+/* minimum time each measurement runs for, in seconds */
+static double min_tm = 0.2;
+/* most render threads to measure with, 0 for one per core */
+static size_t max_threads = 0;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* wt has room for len samples and a guard sample */
+static void wavetable_fill(f64_t *wt, size_t len)
+{
+    size_t n;
+    for (n = 0; n < len; n++) {
+        wt[n] = sin(2. * M_PI * n / len);
+    }
+    wt[len] = wt[0];
+}
+
+/* Starts a voice that lasts longer than any measurement */
+static synth_vc_init_t long_voice(f64_t freq)
+{
+    synth_vc_init_t svi = SYNTH_VC_INIT_DEFAULT;
+    svi.freq = freq;
+    svi.s = 1e6;
+    return svi;
+}
+
+static void bench_synth_vc(void)
+{
+    static const size_t lens[] = { 256, 1024, 4096, 16384, 65536 };
+    static const f64_t freqs[] = { 55, 440, 3520 };
+    const size_t nsamps = 256;
+    f64_t out[256];
+    size_t l, f;
+    int first = 1;
+    printf("  \"synth_vc_proc\": [\n");
+    for (l = 0; l < sizeof(lens)/sizeof(lens[0]); l++) {
+        f64_t *wt = _M(f64_t,(lens[l] + 1));
+        wavetable_fill(wt,lens[l]);
+        synth_vc_proc_t sp = { .sr = BENCH_SR, .wt = wt, .len = lens[l] };
+        for (f = 0; f < sizeof(freqs)/sizeof(freqs[0]); f++) {
+            synth_vc_t vc;
+            synth_vc_init_t svi = long_voice(freqs[f]);
+            synth_vc_init(&vc,&svi);
+            vc.playing = 1;
+            size_t total = 0;
+            double t0 = now(), t;
+            do {
+                _MZ(out,f64_t,nsamps);
+                synth_vc_proc(&vc,&sp,out,nsamps);
+                total += nsamps;
+            } while ((t = now() - t0) < min_tm);
+            double ns = t * 1e9 / total;
+            printf("%s    { \"wavetable_len\": %zu, \"freq\": %g, "
+                   "\"ns_per_sample\": %.3f, \"voices_per_core\": %.1f }",
+                   first ? "" : ",\n",
+                   lens[l], freqs[f], ns, 1e9 / BENCH_SR / ns);
+            first = 0;
+        }
+        _F(wt);
+    }
+    printf("\n  ],\n");
+}
+
+static void bench_synth_bank(void)
+{
+    static const size_t nvoices[] = { 16, 64, 256 };
+    const size_t nsamps = 256, len = 4096;
+    f64_t out[256];
+    f64_t *wt = _M(f64_t,(len + 1));
+    wavetable_fill(wt,len);
+    synth_vc_proc_t sp = { .sr = BENCH_SR, .wt = wt, .len = len };
+    synth_bank_isa_t isa;
+    synth_bank_phase_t phase;
+    size_t v, n;
+    int first = 1, near;
+    printf("  \"synth_bank_proc\": [\n");
+    for (near = 0; near <= 1; near++)
+    for (phase = synth_bank_phase_FLOAT; phase <= synth_bank_phase_FIXED; phase++)
+    for (isa = synth_bank_isa_SCALAR; isa <= synth_bank_isa_AVX512; isa++) {
+        for (v = 0; v < sizeof(nvoices)/sizeof(nvoices[0]); v++) {
+            synth_bank_t b;
+            synth_bank_init_t sbi = SYNTH_BANK_INIT_DEFAULT;
+            sbi.nvoices = nvoices[v];
+            sbi.isa = isa;
+            sbi.phase = phase;
+            sbi.steal = synth_bank_steal_NONE;
+            if (synth_bank_init(&b,&sbi) != err_NONE) {
+                continue;
+            }
+            b.nearest = near;
+            for (n = 0; n < nvoices[v]; n++) {
+                synth_vc_init_t svi = long_voice(55. * (1 + n % 48));
+                synth_bank_add(&b,&sp,&svi,0);
+            }
+            size_t total = 0;
+            double t0 = now(), t;
+            do {
+                _MZ(out,f64_t,nsamps);
+                synth_bank_proc(&b,&sp,out,nsamps);
+                total += nsamps * nvoices[v];
+            } while ((t = now() - t0) < min_tm);
+            double ns = t * 1e9 / total;
+            printf("%s    { \"isa\": \"%s\", \"phase\": \"%s\", "
+                   "\"nearest\": %d, \"voices\": %zu, "
+                   "\"ns_per_voice_sample\": %.3f, \"voices_per_core\": %.1f }",
+                   first ? "" : ",\n",
+                   synth_bank_isa_name(isa),
+                   phase == synth_bank_phase_FIXED ? "fixed" : "float",
+                   near,
+                   nvoices[v],
+                   ns, 1e9 / BENCH_SR / ns);
+            first = 0;
+            synth_bank_destroy(&b);
+        }
+    }
+    printf("\n  ],\n");
+    _F(wt);
+}
+
+static int bench_always(seq_event_t *se, void *data)
+{
+    (void)se;
+    (void)data;
+    return 0;
+}
+
+static void bench_seq_line(int *first, const char *op, size_t seq_len,
+                           size_t nevents, double t, size_t nops)
+{
+    printf("%s    { \"op\": \"%s\", \"seq_len\": %zu, "
+           "\"nevents\": %zu, \"ns_per_op\": %.3f }",
+           *first ? "" : ",\n", op, seq_len, nevents, t * 1e9 / nops);
+    *first = 0;
+}
+
+/* Dense sequences and sparse ones, where only 1 tick in 64 has an event */
+static void bench_seq(void)
+{
+    static const size_t seq_lens[] = { 16, 1024, 16384 };
+    static const size_t n_epts[] = { 0, 8, 64 };
+    size_t l, m, n;
+    int first = 1;
+    printf("  \"seq\": [\n");
+    for (l = 0; l < sizeof(seq_lens)/sizeof(seq_lens[0]); l++) {
+        for (m = 0; m < sizeof(n_epts)/sizeof(n_epts[0]); m++) {
+            size_t seq_len = seq_lens[l], n_ept = n_epts[m],
+                   nevents = n_ept ? seq_len * n_ept : (seq_len + 63) / 64,
+                   stride = n_ept ? 1 : 64;
+            seq_t seq;
+            if (seq_init(&seq,seq_len,BENCH_SR,nevents,NULL) != err_NONE) {
+                continue;
+            }
+            seq_event_t **events = _M(seq_event_t*,nevents);
+            for (n = 0; n < nevents; n++) {
+                events[n] = seq_event_acquire(&seq);
+            }
+            double t0, t_add = 0, t_walk = 0, t_rm = 0;
+            size_t reps = 0, n_walk = 0;
+            do {
+                t0 = now();
+                for (n = 0; n < nevents; n++) {
+                    seq_add_event(&seq,events[n],(n * stride) % seq_len);
+                }
+                t_add += now() - t0;
+                t0 = now();
+                do {
+                    size_t tick;
+                    seq_event_t *se;
+                    for (tick = seq_next_tick(&seq,0);
+                         tick < seq_len;
+                         tick = seq_next_tick(&seq,tick + 1)) {
+                        for (se = seq_first_at_tick(&seq,tick); se; se = seq_next_event(&seq,se)) {
+                            if (seq_event_due(&seq,se)) {
+                                seq_event_set_played(&seq,se);
+                            }
+                        }
+                    }
+                    seq_new_loop(&seq);
+                    n_walk++;
+                } while (now() - t0 < min_tm / 8);
+                t_walk += now() - t0;
+                t0 = now();
+                for (n = 0; n < nevents; n++) {
+                    seq_remove_event(&seq,(n * stride) % seq_len,bench_always,NULL);
+                }
+                t_rm += now() - t0;
+                reps++;
+            } while (t_add + t_walk + t_rm < min_tm);
+            bench_seq_line(&first,"add_event",seq_len,nevents,t_add,reps * nevents);
+            bench_seq_line(&first,"remove_event",seq_len,nevents,t_rm,reps * nevents);
+            bench_seq_line(&first,"walk",seq_len,nevents,t_walk,n_walk);
+            seq_destroy(&seq);
+            _F(events);
+        }
+    }
+    printf("\n  ],\n");
+}
+
+/* Parses datagrams of notes in the text and binary protocols, as the
+ * control thread would before queueing them */
+static void bench_parse(void)
+{
+    enum { NNOTES = 32, DGRAM = 1472 };
+    char text[DGRAM + 1], work[DGRAM + 1];
+    uint8_t bin[DGRAM];
+    size_t n, tlen = 0, blen = PROTO_HDR_LEN, nmsgs;
+    seq_event_t se = SEQ_EVENT_INIT_DEFAULT, out;
+    for (n = 0; n < NNOTES; n++) {
+        se.freq = 55.f * (1 + n);
+        tlen += snprintf(text + tlen,sizeof(text) - tlen,
+                         "note %zu %g %g %g %g %g %g %g %d\n",
+                         n % 16, se.freq, se.env.a, se.env.d, se.env.s,
+                         se.env.r, se.env.max_amp, se.env.sus_amp,
+                         (int)se.env.curve);
+        blen += proto_put_note(bin + blen,sizeof(bin) - blen,n % 16,&se);
+    }
+    proto_put_header(bin,sizeof(bin),NNOTES);
+    size_t tick;
+    volatile f64_t sink = 0;
+    printf("  \"parse\": [\n");
+    /* text, as engine_parse_mess splits and scans it */
+    nmsgs = 0;
+    double t0 = now(), t;
+    do {
+        memcpy(work,text,tlen + 1);
+        char *line, *lasts, *params;
+        for (line = strtok_r(work,"\n",&lasts); line;
+                line = strtok_r(NULL,"\n",&lasts)) {
+            params = strchr(line,' ');
+            if (seq_event_init_from_str(&out,&tick,params) == err_NONE) {
+                sink += out.freq;
+            }
+            nmsgs++;
+        }
+    } while ((t = now() - t0) < min_tm);
+    printf("    { \"protocol\": \"text\", \"bytes_per_note\": %.1f, "
+           "\"ns_per_note\": %.1f, \"notes_per_s\": %.0f },\n",
+           tlen / (double)NNOTES, t * 1e9 / nmsgs, nmsgs / t);
+    nmsgs = 0;
+    t0 = now();
+    do {
+        proto_dec_t d;
+        proto_msg_t m;
+        proto_dec_init(&d,bin,blen);
+        while (proto_dec_next(&d,&m) == err_NONE) {
+            sink += m.note.freq;
+            nmsgs++;
+        }
+    } while ((t = now() - t0) < min_tm);
+    printf("    { \"protocol\": \"binary\", \"bytes_per_note\": %.1f, "
+           "\"ns_per_note\": %.1f, \"notes_per_s\": %.0f }\n",
+           (blen - PROTO_HDR_LEN) / (double)NNOTES, t * 1e9 / nmsgs, nmsgs / t);
+    printf("  ],\n");
+}
+
+/* Fills every tick with notes and times engine_proc, which includes
+ * applying commands, scheduling and mixing. */
+static void bench_engine(void)
+{
+    static const size_t block_sizes[] = { 32, 64, 128, 256, 512, 1024, 2048, 4096 };
+    size_t b, n;
+    int first = 1;
+    printf("  \"engine_proc\": [\n");
+    for (b = 0; b < sizeof(block_sizes)/sizeof(block_sizes[0]); b++) {
+        engine_t e;
+        engine_init_t ei = ENGINE_INIT_DEFAULT;
+        ei.sr = BENCH_SR;
+        ei.nvoices = 64;
+        ei.seq_len = 64;
+        ei.max_events = 4 * ei.seq_len;
+        ei.tick_len = 0.05;
+        if (engine_init(&e,&ei) != err_NONE) {
+            continue;
+        }
+        f64_t *out = _M(f64_t,block_sizes[b]);
+        for (n = 0; n < ei.max_events; n++) {
+            seq_event_t *se = seq_event_acquire(&e.tracks[0].seq);
+            *se = SEQ_EVENT_INIT_DEFAULT;
+            se->freq = 55. * (1 + n % 48);
+            se->env.s = 0.1;
+            se->env.r = 0.1;
+            cmd_t c = { .type = cmd_NOTE, .tick = n % ei.seq_len, .event = se };
+            if (cmdq_push(&e.cmdq,&c) != err_NONE) {
+                seq_event_release(&e.tracks[0].seq,se);
+            }
+        }
+        size_t periods = 0;
+        double t0 = now(), t;
+        do {
+            engine_proc(&e,out,block_sizes[b]);
+            engine_free_returned(&e);
+            periods++;
+        } while ((t = now() - t0) < min_tm);
+        double ns = t * 1e9 / periods;
+        printf("%s    { \"block_size\": %zu, \"voices\": %zu, "
+               "\"ns_per_period\": %.1f, \"ns_per_sample\": %.3f, "
+               "\"budget_fraction\": %.4f }",
+               first ? "" : ",\n", block_sizes[b], ei.nvoices,
+               ns, ns / block_sizes[b],
+               ns * 1e-9 / (block_sizes[b] / (double)BENCH_SR));
+        first = 0;
+        _F(out);
+        engine_destroy(&e);
+    }
+    printf("\n  ],\n");
+}
+
+/* Times engine_proc with the same notes spread over more and more tracks
+ * of different lengths, each with a sparse sequence of 256 ticks */
+static void bench_tracks(void)
+{
+    static const size_t ntracks[] = { 1, 16, 64, 256 };
+    static const size_t block_size = 256, nnotes = 64;
+    size_t k, n;
+    int first = 1;
+    printf("  \"engine_tracks\": [\n");
+    for (k = 0; k < sizeof(ntracks)/sizeof(ntracks[0]); k++) {
+        engine_t *e = _M(engine_t,1);
+        engine_init_t ei = ENGINE_INIT_DEFAULT;
+        engine_track_init_t *ti = _M(engine_track_init_t,ntracks[k]);
+        for (n = 0; n < ntracks[k]; n++) {
+            ti[n] = (engine_track_init_t) {
+                .seq_len = 256 - n % 7,
+                .tick_len = 0.01,
+                .max_events = nnotes,
+                .nvoices = 64
+            };
+        }
+        ei.sr = BENCH_SR;
+        ei.nvoices = 64;
+        ei.ntracks = ntracks[k];
+        ei.tracks = ti;
+        if (engine_init(e,&ei) != err_NONE) {
+            _F(ti);
+            _F(e);
+            continue;
+        }
+        f64_t *out = _M(f64_t,block_size);
+        for (n = 0; n < nnotes; n++) {
+            size_t track = n % ntracks[k];
+            seq_event_t *se = seq_event_acquire(&e->tracks[track].seq);
+            *se = SEQ_EVENT_INIT_DEFAULT;
+            se->freq = 55. * (1 + n % 48);
+            se->env.s = 0.01;
+            se->env.r = 0.01;
+            cmd_t c = { .type = cmd_NOTE, .tick = (n * 37) % 249,
+                        .event = se, .track = track };
+            cmdq_push(&e->cmdq,&c);
+        }
+        size_t periods = 0;
+        double t0 = now(), t;
+        do {
+            engine_proc(e,out,block_size);
+            engine_free_returned(e);
+            periods++;
+        } while ((t = now() - t0) < min_tm);
+        printf("%s    { \"tracks\": %zu, \"notes\": %zu, \"block_size\": %zu, "
+               "\"ns_per_period\": %.1f }",
+               first ? "" : ",\n", ntracks[k], nnotes, block_size,
+               t * 1e9 / periods);
+        first = 0;
+        _F(out);
+        engine_destroy(e);
+        _F(e);
+        _F(ti);
+    }
+    printf("\n  ],\n");
+}
+
+/* Times engine_proc with many voices and 1 to max_threads render threads */
+static void bench_threads(void)
+{
+    static const size_t block_sizes[] = { 64, 256, 1024 };
+    static const size_t nvoices[] = { 256, 2048 };
+    size_t b, v, t, n, nt = max_threads;
+    int first = 1;
+    if (nt == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nt = ncpu > 0 ? ncpu : 1;
+    }
+    printf("  \"engine_threads\": [\n");
+    for (v = 0; v < sizeof(nvoices)/sizeof(nvoices[0]); v++)
+    for (b = 0; b < sizeof(block_sizes)/sizeof(block_sizes[0]); b++) {
+        double ns_1 = 0;
+        for (t = 1; t <= nt; t++) {
+            engine_t *e = _M(engine_t,1);
+            engine_init_t ei = ENGINE_INIT_DEFAULT;
+            ei.sr = BENCH_SR;
+            ei.nvoices = nvoices[v];
+            ei.seq_len = 1;
+            ei.max_events = nvoices[v];
+            ei.tick_len = 60;
+            ei.cmdq_size = nvoices[v];
+            ei.nthreads = t;
+            if (engine_init(e,&ei) != err_NONE) {
+                _F(e);
+                continue;
+            }
+            f64_t *out = _M(f64_t,block_sizes[b]);
+            for (n = 0; n < nvoices[v]; n++) {
+                seq_event_t *se = seq_event_acquire(&e->tracks[0].seq);
+                *se = SEQ_EVENT_INIT_DEFAULT;
+                se->freq = 30. + n * 0.37;
+                se->env.s = 60;
+                cmd_t c = { .type = cmd_NOTE, .tick = 0, .event = se };
+                cmdq_push(&e->cmdq,&c);
+            }
+            /* the notes are only playable from the second time round, so
+             * start just before it */
+            e->tracks[0].loop_start = 1 - e->tracks[0].seq.loop_time;
+            e->tracks[0].next_time = 1;
+            engine_proc(e,out,block_sizes[b]);
+            size_t periods = 0;
+            double t0 = now(), tm;
+            do {
+                engine_proc(e,out,block_sizes[b]);
+                periods++;
+            } while ((tm = now() - t0) < min_tm);
+            double ns = tm * 1e9 / periods;
+            if (t == 1) {
+                ns_1 = ns;
+            }
+            printf("%s    { \"threads\": %zu, \"voices\": %zu, "
+                   "\"block_size\": %zu, \"ns_per_period\": %.1f, "
+                   "\"speedup\": %.2f }",
+                   first ? "" : ",\n", t, e->bank.nactive, block_sizes[b],
+                   ns, ns_1 / ns);
+            first = 0;
+            _F(out);
+            engine_destroy(e);
+            _F(e);
+        }
+    }
+    printf("\n  ]\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    while ((opt = getopt(argc,argv,"t:n:")) != -1) {
+        switch (opt) {
+            case 't': min_tm = atof(optarg); break;
+            case 'n': max_threads = strtoul(optarg,NULL,10); break;
+            default:
+                fprintf(stderr,"usage: %s [-t seconds_per_measurement] "
+                        "[-n max_threads]\n",argv[0]);
+                return 1;
+        }
+    }
+    printf("{\n  \"sample_rate\": %d,\n",BENCH_SR);
+    bench_synth_vc();
+    bench_synth_bank();
+    bench_seq();
+    bench_parse();
+    bench_engine();
+    bench_tracks();
+    bench_threads();
+    printf("}\n");
+    return 0;
+}
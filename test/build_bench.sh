@@ -0,0 +1,5 @@
+#/bin/bash
+CC=gcc
+$CC synth.c env.c synth_bank.c wtset.c arena.c seq.c cmdq.c proto.c workers.c logq.c stats.c snap.c engine.c test/bench.c -O2 -g -o \
+    test/bench.bin -lpthread -lm \
+    -I. $CFLAGS
@@ -0,0 +1,5 @@
+#/bin/bash
+CC=gcc
+$CC synth.c env.c synth_bank.c wtset.c arena.c seq.c cmdq.c proto.c workers.c logq.c stats.c snap.c engine.c config.c test/render.c -g -o \
+    test/render.bin -lpthread -lm \
+    -I. $CFLAGS
@@ -1,5 +1,5 @@
 #/bin/bash
 CC=gcc
-$CC synth.c seq.c test/seq_synth_sched_test.c -g -o \
-    test/seq_synth_sched_test.bin -ljack -lpthread \
+$CC synth.c env.c synth_bank.c wtset.c arena.c seq.c cmdq.c proto.c workers.c logq.c stats.c snap.c engine.c config.c test/seq_synth_sched_test.c -g -o \
+    test/seq_synth_sched_test.bin -ljack -lpthread -lm \
     -I/usr/local/include -I. -L/usr/local/lib $CFLAGS
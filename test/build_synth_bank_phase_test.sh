@@ -0,0 +1,5 @@
+#/bin/bash
+CC=gcc
+$CC synth.c env.c synth_bank.c wtset.c arena.c test/synth_bank_phase_test.c -O2 -g -o \
+    test/synth_bank_phase_test.bin -lm \
+    -I. $CFLAGS
@@ -0,0 +1,279 @@
+/* Renders the engine offline, as fast as possible, to a WAV or raw float
+ * file. Commands are read from a script, one message per line in the same
+ * format as the UDP messages, plus
+ *     wait <seconds>
+ * which renders that long before the following lines are applied. After
+ * the script, -t seconds more are rendered. -T gives the lengths in ticks
+ * of as many tracks, comma separated; "track <n>" lines pick the track
+ * the lines after are for. Any other engine setting can be given with -k
+ * key=value or read from a file with -c (see config.h), in order with the
+ * other options. Snapshots are saved and loaded in the current directory
+ * unless snap_dir says otherwise. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "defs.h"
+#include "types.h"
+#include "engine.h"
+#include "config.h"
+
+#define MAXLINELEN 1024
+#define MAX_TRACKS 256
+
+typedef enum out_fmt_t {
+    out_fmt_WAV,
+    out_fmt_RAW
+} out_fmt_t;
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-r sample_rate] [-b block_size] [-t seconds] "
+            "[-v voices] [-s none|oldest|quietest|release] "
+            "[-p float|fixed] [-j threads] [-T ticks,...] [-f wav|raw] "
+            "[-c config] [-k key=value] [-o output] [script]\n",
+            name);
+}
+
+static void put_u32(FILE *f, uint32_t x)
+{
+    unsigned char b[4] = { x, x >> 8, x >> 16, x >> 24 };
+    fwrite(b,1,4,f);
+}
+
+static void put_u16(FILE *f, uint16_t x)
+{
+    unsigned char b[2] = { x, x >> 8 };
+    fwrite(b,1,2,f);
+}
+
+/* 32-bit float mono WAV header, data_len in bytes */
+static void wav_header(FILE *f, uint32_t sr, uint32_t data_len)
+{
+    fwrite("RIFF",1,4,f);
+    put_u32(f,36 + data_len);
+    fwrite("WAVE",1,4,f);
+    fwrite("fmt ",1,4,f);
+    put_u32(f,16);
+    put_u16(f,3); /* WAVE_FORMAT_IEEE_FLOAT */
+    put_u16(f,1);
+    put_u32(f,sr);
+    put_u32(f,sr * sizeof(float));
+    put_u16(f,sizeof(float));
+    put_u16(f,32);
+    fwrite("data",1,4,f);
+    put_u32(f,data_len);
+}
+
+static void put_samples(FILE *f, f64_t *buf, size_t n)
+{
+    size_t i;
+    for (i = 0; i < n; i++) {
+        union { float f; uint32_t u; } x = { .f = buf[i] };
+        put_u32(f,x.u);
+    }
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef struct render_t {
+    engine_t *e;
+    FILE *out;
+    f64_t *buf;
+    size_t block_size;
+    size_t nsamps;  /* rendered so far */
+    double proc_tm; /* seconds spent in engine_proc */
+} render_t;
+
+static void render(render_t *r, size_t nsamps)
+{
+    while (nsamps) {
+        size_t n = nsamps < r->block_size ? nsamps : r->block_size;
+        double t0 = now();
+        engine_proc(r->e,r->buf,n);
+        r->proc_tm += now() - t0;
+        /* there is no other thread, so this is the control thread too */
+        engine_free_returned(r->e);
+        if (r->e->silent) {
+            /* 0.f is all zero bits, whatever the byte order */
+            fwrite(r->buf,sizeof(float),n,r->out);
+        } else {
+            put_samples(r->out,r->buf,n);
+        }
+        r->nsamps += n;
+        nsamps -= n;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    engine_init_t ei = ENGINE_INIT_DEFAULT;
+    strcpy(ei.snap_dir,".");
+    size_t block_size = 256;
+    f64_t tail = 16;
+    out_fmt_t fmt = out_fmt_WAV;
+    const char *out_path = "render.wav";
+    int opt;
+    size_t cfg_line;
+    static engine_track_init_t tracks[MAX_TRACKS];
+    char *lens = NULL;
+    while ((opt = getopt(argc,argv,"r:b:t:v:s:p:j:T:f:c:k:o:h")) != -1) {
+        switch (opt) {
+            case 'r': ei.sr = atof(optarg); break;
+            case 'b': block_size = strtoul(optarg,NULL,10); break;
+            case 't': tail = atof(optarg); break;
+            case 'v': ei.nvoices = strtoul(optarg,NULL,10); break;
+            case 's':
+                if (config_set(&ei,"steal",optarg) != err_NONE) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'p':
+                if (config_set(&ei,"phase",optarg) != err_NONE) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'j': ei.nthreads = strtoul(optarg,NULL,10); break;
+            case 'T': lens = optarg; break;
+            case 'f':
+                if (strcmp(optarg,"raw") == 0) {
+                    fmt = out_fmt_RAW;
+                } else if (strcmp(optarg,"wav") == 0) {
+                    fmt = out_fmt_WAV;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            case 'c':
+                if (config_load(&ei,optarg,&cfg_line) != err_NONE) {
+                    fprintf(stderr,"%s:%zu: bad config\n",optarg,cfg_line);
+                    return 1;
+                }
+                break;
+            case 'k':
+                if (config_set_str(&ei,optarg) != err_NONE) {
+                    fprintf(stderr,"bad setting: %s\n",optarg);
+                    return 1;
+                }
+                break;
+            case 'o': out_path = optarg; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if ((block_size == 0) || (ei.sr <= 0)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (lens) {
+        /* the same tempo and voices as a single track would have */
+        char *tok, *lasts;
+        ei.ntracks = 0;
+        for (tok = strtok_r(lens,",",&lasts); tok; tok = strtok_r(NULL,",",&lasts)) {
+            if (ei.ntracks == MAX_TRACKS) {
+                usage(argv[0]);
+                return 1;
+            }
+            tracks[ei.ntracks++] = (engine_track_init_t) {
+                .seq_len = strtoul(tok,NULL,10),
+                .tick_len = ei.tick_len,
+                .max_events = ei.max_events,
+                .nvoices = ei.nvoices
+            };
+        }
+        ei.tracks = tracks;
+    }
+    FILE *script = NULL;
+    if (optind < argc) {
+        script = fopen(argv[optind],"r");
+        if (!script) {
+            perror(argv[optind]);
+            return 1;
+        }
+    }
+    engine_t e;
+    ei.log_out = stderr;
+    if (engine_init(&e,&ei) != err_NONE) {
+        fprintf(stderr,"could not initialize engine\n");
+        return 1;
+    }
+    render_t r = {
+        .e = &e,
+        .block_size = block_size,
+        .buf = _M(f64_t,block_size)
+    };
+    r.out = fopen(out_path,"wb");
+    if (!(r.out && r.buf)) {
+        perror(out_path);
+        return 1;
+    }
+    if (fmt == out_fmt_WAV) {
+        /* sizes are filled in once the length is known */
+        wav_header(r.out,(uint32_t)ei.sr,0);
+    }
+    char line[MAXLINELEN];
+    while (script && fgets(line,sizeof(line),script)) {
+        f64_t wait_s;
+        if (sscanf(line,"wait %f",&wait_s) == 1) {
+            render(&r,(size_t)(wait_s * ei.sr));
+            continue;
+        }
+        line[strcspn(line,"\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        engine_parse_batch(&e,line,strlen(line));
+        if (e.quit) {
+            break;
+        }
+    }
+    render(&r,(size_t)(tail * ei.sr));
+    if (fmt == out_fmt_WAV) {
+        fseek(r.out,0,SEEK_SET);
+        wav_header(r.out,(uint32_t)ei.sr,r.nsamps * sizeof(float));
+    }
+    fclose(r.out);
+    if (script) {
+        fclose(script);
+    }
+    size_t n_applied, n_dropped, n_logged, n_log_dropped;
+    cmdq_stats(&e.cmdq,&n_applied,&n_dropped);
+    logq_stats(&e.log,&n_logged,&n_log_dropped);
+    fprintf(stderr,
+            "rendered %zu samples (%.2f s) in blocks of %zu: "
+            "%.3f s in engine, %.1fx realtime\n"
+            "commands applied: %zu, dropped: %zu, bad messages: %zu\n"
+            "notes dropped: %zu, voices stolen: %zu, retriggered: %zu\n"
+            "log messages: %zu, dropped: %zu\n",
+            r.nsamps, r.nsamps / ei.sr, block_size,
+            r.proc_tm, r.proc_tm > 0 ? r.nsamps / ei.sr / r.proc_tm : 0.,
+            n_applied, n_dropped, e.n_bad,
+            e.bank.n_dropped, e.bank.n_stolen, e.bank.n_retrig,
+            n_logged, n_log_dropped);
+    size_t n;
+    for (n = 0; n < e.ntracks; n++) {
+        seq_t *s = &e.tracks[n].seq;
+        fprintf(stderr,"track %zu events in use: %zu of %zu, most used: %zu, "
+                "exhausted: %zu\n",
+                n, s->pool_used, s->pool_size, s->pool_hwm, s->pool_n_exhausted);
+    }
+    char stats[ENGINE_REPLY_LEN];
+    engine_stats_str(&e,stats,sizeof stats);
+    fprintf(stderr,"%s",stats);
+    _F(r.buf);
+    engine_destroy(&e);
+    return 0;
+}
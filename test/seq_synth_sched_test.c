@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* recvmmsg */
 #include <stdio.h>
 #include <errno.h>
 #include <unistd.h>
@@ -7,6 +8,7 @@
 #include <pthread.h> 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
@@ -16,201 +18,86 @@
 
 #include "defs.h" 
 #include "types.h"
-#include "synth.h"
-#include "seq.h"
+#include "engine.h"
+#include "config.h"
 
 #define MYPORT "4950"	// the port users will be connecting to
 
-#define MAXBUFLEN 100
-
-#define WAVETABLE_LEN 4096
-#define WAVETABLE_NHARM 10 
-#define NUM_VOICES 10 
-#define SEQ_LEN 16 
-#define N_EVENTS_PER_TICK 8
+/* Datagrams can hold many newline separated text messages, or binary ones
+ * (see proto.h), up to the largest
+ * UDP payload in a 1500 byte MTU. Up to RECV_BATCH datagrams are read per
+ * recvmmsg. */
+#define MAXBUFLEN 1472
+#define RECV_BATCH 64
+#define RECV_SOCKBUF (1 << 20)
+/* Longest wait for a datagram, in microseconds, so what the audio thread
+ * hands back, such as a save, is seen to without one arriving */
+#define RECV_TIMEOUT_US 10000
+
+/* Defaults for the tracks, the realtime priority of any render threads
+ * besides JACK's and the share of each period spent before shedding load.
+ * The rest are the engine's, and any can be changed with a config file or
+ * key=value arguments (see config.h). "save" and "load" are refused unless
+ * snap_dir is set. */
+#define NUM_TRACKS 16
+#define RENDER_RT_PRIO 70
+#define SHED_LOAD 0.8
+/* seconds between stats being printed, which "stats" also replies with */
+#define STATS_PERIOD_S 60
 
 static volatile int done = 0;
 
 void sigintfun(int signum) { done = 1; }
 
-// get sockaddr, IPv4 or IPv6:
-void *get_in_addr(struct sockaddr *sa)
+static void
+usage (const char *name)
 {
-	if (sa->sa_family == AF_INET) {
-		return &(((struct sockaddr_in*)sa)->sin_addr);
-	}
-
-	return &(((struct sockaddr_in6*)sa)->sin6_addr);
+	fprintf (stderr, "usage: %s [-c config] [key=value ...]\n"
+		 "the sample rate is always JACK's\n", name);
 }
 
-typedef struct synth_vc_init_list_t {
-    synth_vc_init_t head;
-    struct synth_vc_init_list_t *next;
-} synth_vc_init_list_t;
-
-static synth_vc_init_list_t *svci = NULL,
-                            *svci_used = NULL;
-
-synth_vc_proc_t synthproc;
-
-pthread_mutex_t voice_mutex;
-pthread_mutex_t seq_inc_mutex;
-
-static const int nvoices = NUM_VOICES;
-static synth_vc_t voices[NUM_VOICES];
-
-static f64_t *wt;
-int seq_time_rollover = 0;
-f64_t seq_time = 0., tot_seq_time, tick_len;
-seq_t seq;
+static engine_t engine;
 
 //jack_port_t *input_port;
 jack_port_t *output_port;
 jack_client_t *client;
 
 
-static void wavetable_init(f64_t *wt, size_t len, size_t nharm)
-{
-    /* Initializes with harmonic series */
-    size_t n, m;
-    _MZ(wt,f64_t,len);
-    for (n = 1; n <= nharm; n++) {
-        f64_t phs_inc = 2. * M_PI * (f64_t)n / len,
-              phs = 0;
-        for (m = 0; m < len; m++) {
-            wt[m] += cos(phs) / (f64_t)(n*n);
-            phs += phs_inc;
-        }
-    }
-}
-
-/* Should only be called if seq_inc_mutex is owned by the calling thread */
-static void parse_mess(char *buf)
-{
-    char *sep1 = " ", *sep2 = "\n",
-         *lasts;
-    fprintf(stderr,"parsing msg: %s\n",buf);
-    strtok_r(buf,sep1,&lasts);
-    if (strcmp(buf,"note") == 0) {
-        fprintf(stderr,"got note\n");
-        seq_event_t *tmp = _C(seq_event_t,1);
-        if (!tmp) { return; }
-        char *lasts2;
-        if (lasts) {
-            strtok_r(lasts,sep2,&lasts2);
-            fprintf(stderr,"parameters = %s\n",lasts);
-        }
-        size_t tick;
-        if (seq_event_init_from_str(tmp,&tick,lasts)
-                != err_NONE) {
-            _F(tmp);
-            return;
-        }
-        tmp->played = 1; /* don't play until the next time around */
-        if (seq_add_event(&seq,tmp,tick) != err_NONE) {
-            _F(tmp);
-        }
-    }
-    if (strcmp(buf,"clear") == 0) {
-        fprintf(stderr,"got clear\n");
-        seq_remove_all_events(&seq);
-    }
-    if (strcmp(buf,"tempo") == 0) {
-        fprintf(stderr,"got tempo\n");
-        char *lasts2;
-        if (lasts) {
-            strtok_r(lasts,sep2,&lasts2);
-            fprintf(stderr,"parameters = %s\n",lasts);
-        }
-        f64_t tempo_s = 1.; /* paranoid, don't set tempo to garbage */
-        if (sscanf(lasts,"%f",&tempo_s) == 1) {
-            tick_len = tempo_s * (f64_t)jack_get_sample_rate(client);
-        }
-    }
-    if (strcmp(buf,"quit") == 0) {
-        fprintf(stderr,"quitting\n");
-        done = 1;
-    }
-}
-
 int
 process (jack_nframes_t nframes, void *arg)
 {
-    /* The number of times the sequencer time couldn't get increased
-     * because the mutex was taken */
-    static size_t num_seq_inc_miss = 1;
 	jack_default_audio_sample_t *out;
 //	jack_default_audio_sample_t *in, *out;
 	
 //	in = jack_port_get_buffer (input_port, nframes);
-    /* Go through init structs and activate synths if they are available. */
-    size_t n;
-    if (pthread_mutex_trylock(&seq_inc_mutex)) {
-        /* if time rolled over, reset all to unplayed */
-        if (seq_time_rollover) {
-            seq_time_rollover = 0;
-            seq_events_set_unplayed(&seq);
-        }
-        /* first play all scheduled events that haven't yet been played */
-        f64_t cursor_time = 0;
-        for (cursor_time = 0; cursor_time < seq_time; cursor_time += seq.tick_len) {
-            size_t seq_idx = (size_t)cursor_time/seq.tick_len;
-            seq_event_t **se;
-            se = seq_get_events_at_tick(&seq,seq_idx);
-            if (!se) {
-                continue;
-            }
-            size_t m;
-            for (m = 0; m < seq._n_events_per_tick; m++) {
-                if (se[m] && (se[m]->played == 0)) {
-                    /* find free voice */
-                    int free_voice = -1, o;
-                    for (o = 0; o < nvoices; o++) {
-                        if (!voices[o].playing) {
-                            free_voice = o;
-                            o = nvoices; /* break for loop */
-                        }
-                    }
-                    if (free_voice >= 0) {
-                        /* activate this synth */
-                        synth_vc_init_t svi = {
-                            .freq = se[m]->freq,
-                            .a = se[m]->env.a,
-                            .d = se[m]->env.d,
-                            .s = se[m]->env.s,
-                            .r = se[m]->env.r,
-                            .max_amp = se[m]->env.max_amp,
-                            .sus_amp = se[m]->env.sus_amp
-                        };
-                        synth_vc_init(&voices[free_voice],
-                                &svi);
-                        voices[free_voice].playing = 1;
-                        se[m]->played = 1;
-                    }
-                }
-            }
-        }
-
-        seq_time += tick_len*num_seq_inc_miss;
-        if (seq_time >= tot_seq_time) {
-            seq_time_rollover = 1;
-            while (seq_time >= tot_seq_time) {
-                seq_time -= tot_seq_time;
-            }
-        }
-        num_seq_inc_miss = 1;
-        pthread_mutex_unlock(&seq_inc_mutex);
-    } else {
-        num_seq_inc_miss++;
-    }
 	out = jack_port_get_buffer (output_port, nframes);
-    _MZ(out,jack_default_audio_sample_t,nframes);
-    for (n = 0; n < nvoices; n++) {
-        if (voices[n].playing) {
-            synth_vc_proc(&voices[n],&synthproc,out,nframes);
+    engine_proc(&engine,out,nframes);
+	return 0;      
+}
+
+int
+xrun (void *arg)
+{
+    engine_xrun(&engine);
+    return 0;
+}
+
+/* Prints the engine's stats every STATS_PERIOD_S until told to stop */
+static void *
+stats_main (void *arg)
+{
+    static char buf[ENGINE_REPLY_LEN];
+    int n = 0;
+    while (!(done || engine.quit)) {
+        sleep(1);
+        if (++n == STATS_PERIOD_S) {
+            engine_stats_str(&engine,buf,sizeof buf);
+            printf("%s",buf);
+            fflush(stdout);
+            n = 0;
         }
     }
-	return 0;      
+    return NULL;
 }
 
 /**
@@ -232,8 +119,33 @@ main (int argc, char *argv[])
 	jack_options_t options = JackNullOption;
 	jack_status_t status;
 
-    _MZ(voices,synth_vc_t,NUM_VOICES);
-    /* after this voices only touched in process thread */
+    engine_init_t ei = ENGINE_INIT_DEFAULT;
+    ei.ntracks = NUM_TRACKS;
+    ei.rt_prio = RENDER_RT_PRIO;
+    ei.shed_load = SHED_LOAD;
+    ei.log_out = stderr;
+    int opt;
+    size_t line;
+    while ((opt = getopt(argc, argv, "c:h")) != -1) {
+        switch (opt) {
+            case 'c':
+                if (config_load(&ei, optarg, &line) != err_NONE) {
+                    fprintf(stderr, "%s:%zu: bad config\n", optarg, line);
+                    exit (1);
+                }
+                break;
+            default:
+                usage(argv[0]);
+                exit (1);
+        }
+    }
+    for (; optind < argc; optind++) {
+        if (config_set_str(&ei, argv[optind]) != err_NONE) {
+            fprintf(stderr, "bad setting: %s\n", argv[optind]);
+            usage(argv[0]);
+            exit (1);
+        }
+    }
 	
 #ifndef DEBUG
 	/* open a client connection to the JACK server */
@@ -260,6 +172,7 @@ main (int argc, char *argv[])
 	*/
 
 	jack_set_process_callback (client, process, 0);
+	jack_set_xrun_callback (client, xrun, 0);
 
 	/* tell the JACK server to call `jack_shutdown()' if
 	   it ever shuts down, either entirely, or if it
@@ -274,20 +187,29 @@ main (int argc, char *argv[])
 	printf ("engine sample rate: %" PRIu32 "\n",
 		jack_get_sample_rate (client));
 
-    f64_t *wt = _M(f64_t,WAVETABLE_LEN);
-    wavetable_init(wt,WAVETABLE_LEN,WAVETABLE_NHARM);
-    synthproc = (synth_vc_proc_t) {
-        .sr = (f64_t)jack_get_sample_rate(client),
-        .wt = wt,
-        .len = WAVETABLE_LEN,
-    };
-    
     /* each tick lasts 1 second */
-    seq_init(&seq,SEQ_LEN,N_EVENTS_PER_TICK,(f64_t)jack_get_sample_rate(client));
-
-    tot_seq_time = seq.tick_len * seq._seq_len;
-    tick_len = seq.tick_len;
+    ei.sr = (f64_t)jack_get_sample_rate(client);
+#endif
+    if (engine_init(&engine,&ei) != err_NONE) {
+        fprintf(stderr, "could not initialize engine\n");
+        exit (1);
+    }
+    printf ("voice kernel: %s, %zu voices per call, %zu render threads\n",
+            synth_bank_isa_name(engine.bank.isa), engine.bank.width,
+            engine.workers.nthreads);
+    printf ("memory: %zu bytes%s\n", engine.arena.size,
+            engine.arena.locked ? ", locked" : "");
+    if (!engine.arena.locked) {
+        fprintf(stderr, "memory could not be locked\n");
+    }
+    if (engine.workers.n_no_rt) {
+        fprintf(stderr, "%zu render threads are not realtime\n",
+                engine.workers.n_no_rt);
+    }
+    /* after this the engine's sequence and voices are only touched in the
+     * process thread */
 
+#ifndef DEBUG
 	/* create two ports */
 
 	//input_port = jack_port_register (client, "input",
@@ -349,11 +271,12 @@ main (int argc, char *argv[])
 	int sockfd;
 	struct addrinfo hints, *servinfo, *p;
 	int rv;
-	int numbytes;
-	struct sockaddr_storage their_addr;
-	char buf[MAXBUFLEN];
-	socklen_t addr_len;
-	char s[INET6_ADDRSTRLEN];
+	int numdgrams;
+	static char bufs[RECV_BATCH][MAXBUFLEN + 1];
+	struct iovec iovs[RECV_BATCH];
+	struct mmsghdr msgs[RECV_BATCH];
+	struct sockaddr_storage addrs[RECV_BATCH];
+	size_t n_dgrams = 0, n_bytes = 0, n_trunc = 0, n_calls = 0;
 
 	memset(&hints, 0, sizeof hints);
 	hints.ai_family = AF_UNSPEC; // set to AF_INET to force IPv4
@@ -373,6 +296,12 @@ main (int argc, char *argv[])
 			continue;
 		}
 
+		/* room for a burst, such as a whole pattern being uploaded */
+		int sockbuf = RECV_SOCKBUF;
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &sockbuf, sizeof sockbuf);
+		struct timeval tv = { .tv_sec = 0, .tv_usec = RECV_TIMEOUT_US };
+		setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof tv);
+
 		if (bind(sockfd, p->ai_addr, p->ai_addrlen) == -1) {
 			close(sockfd);
 			perror("listener: bind");
@@ -390,37 +319,77 @@ main (int argc, char *argv[])
 	freeaddrinfo(servinfo);
 
     signal(SIGINT,sigintfun);
+    pthread_t stats_thread;
+    pthread_create(&stats_thread,NULL,stats_main,NULL);
 	printf("listener: waiting to recvfrom...\n");
 
-	addr_len = sizeof their_addr;
+    memset(msgs, 0, sizeof msgs);
+    int n;
+    for (n = 0; n < RECV_BATCH; n++) {
+        iovs[n].iov_base = bufs[n];
+        iovs[n].iov_len = MAXBUFLEN;
+        msgs[n].msg_hdr.msg_iov = &iovs[n];
+        msgs[n].msg_hdr.msg_iovlen = 1;
+        msgs[n].msg_hdr.msg_name = &addrs[n];
+    }
 
-    pthread_mutex_init(&voice_mutex,NULL);
-    pthread_mutex_init(&seq_inc_mutex,NULL);
-    while (!done) {
-        if ((numbytes = recvfrom(sockfd, buf, MAXBUFLEN-1 , 0,
-                        (struct sockaddr *)&their_addr, &addr_len)) == -1) {
-            perror("recvfrom");
-            exit(1);
+    while (!(done || engine.quit)) {
+        /* blocks for the first datagram, or RECV_TIMEOUT_US, then takes
+         * whatever else is already queued */
+        for (n = 0; n < RECV_BATCH; n++) {
+            msgs[n].msg_hdr.msg_namelen = sizeof addrs[n];
+        }
+        if ((numdgrams = recvmmsg(sockfd, msgs, RECV_BATCH,
+                        MSG_WAITFORONE, NULL)) == -1) {
+            if ((errno != EINTR) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                perror("recvmmsg");
+                exit(1);
+            }
+            numdgrams = 0;
+        } else {
+            n_calls++;
+        }
+        engine_free_returned(&engine);
+        for (n = 0; (n < numdgrams) && !engine.quit; n++) {
+            if (msgs[n].msg_hdr.msg_flags & MSG_TRUNC) {
+                /* the last message would be cut short */
+                n_trunc++;
+                continue;
+            }
+            n_dgrams++;
+            n_bytes += msgs[n].msg_len;
+            engine_parse_dgram(&engine, bufs[n], msgs[n].msg_len);
+            /* the IDs of any notes, so the sender can change them */
+            if (engine.reply_len) {
+                sendto(sockfd, engine.reply, engine.reply_len, 0,
+                       msgs[n].msg_hdr.msg_name, msgs[n].msg_hdr.msg_namelen);
+            }
         }
-
-        printf("listener: got packet from %s\n",
-                inet_ntop(their_addr.ss_family,
-                    get_in_addr((struct sockaddr *)&their_addr),
-                    s, sizeof s));
-        printf("listener: packet is %d bytes long\n", numbytes);
-        buf[numbytes] = '\0';
-        pthread_mutex_lock(&seq_inc_mutex);
-        parse_mess(buf);
-        pthread_mutex_unlock(&seq_inc_mutex);
     }
 
 	close(sockfd);
+    done = 1;
+    pthread_join(stats_thread,NULL);
 #ifndef DEBUG
 	jack_client_close (client);
 #endif
-    _F(wt);
-    seq_remove_all_events(&seq);
-    seq_destroy(&seq);
+    printf("listener: %zu datagrams, %zu bytes in %zu calls, "
+           "%zu too long, %zu bad messages\n",
+           n_dgrams, n_bytes, n_calls, n_trunc, engine.n_bad);
+    size_t n_applied, n_dropped;
+    cmdq_stats(&engine.cmdq,&n_applied,&n_dropped);
+    printf("commands applied: %zu, dropped: %zu\n",n_applied,n_dropped);
+    size_t n_logged, n_log_dropped;
+    logq_stats(&engine.log,&n_logged,&n_log_dropped);
+    printf("log messages: %zu, dropped: %zu\n",n_logged,n_log_dropped);
+    printf("notes dropped: %zu, voices stolen: %zu, retriggered: %zu\n",
+           engine.bank.n_dropped,engine.bank.n_stolen,engine.bank.n_retrig);
+    for (n = 0; n < (int)engine.ntracks; n++) {
+        printf("track %d events most used: %zu of %zu, exhausted: %zu\n", n,
+               engine.tracks[n].seq.pool_hwm,engine.tracks[n].seq.pool_size,
+               engine.tracks[n].seq.pool_n_exhausted);
+    }
+    engine_destroy(&engine);
 	exit (0);
 }
 
@@ -1,5 +1,77 @@
 # Socket for communicating with synth
 import socket
+import struct
+
+# Binary messages, see proto.h
+PROTO_MAGIC = 0xb5
+PROTO_VERSION = 1
+PROTO_NOTE = 1
+PROTO_CLEAR = 2
+PROTO_TEMPO = 3
+PROTO_REMOVE = 4
+PROTO_UNNOTE = 5
+PROTO_UPDATE = 6
+PROTO_ID = 7
+PROTO_VOICES = 8
+
+def bin_msg(mtype, body=b'', track=0):
+    return struct.pack('<BBH', mtype, track, len(body)) + body
+
+def on_track(msg, track):
+    '''
+    the binary message msg addressed to track instead
+    '''
+    return msg[:1] + bytes([track]) + msg[2:]
+
+def note_body(tick, freq, a=0.01, d=0.01, s=0.5, r=0.5, max_amp=1.,
+              sus_amp=0.5, curve=0):
+    return struct.pack('<I7fB3x', tick, freq, a, d, s, r, max_amp, sus_amp,
+                       curve)
+
+def bin_note(tick, freq, *args, **kwargs):
+    return bin_msg(PROTO_NOTE, note_body(tick, freq, *args, **kwargs))
+
+def bin_unnote(note_id):
+    return bin_msg(PROTO_UNNOTE, struct.pack('<Q', note_id))
+
+def bin_update(note_id, tick, freq, *args, **kwargs):
+    return bin_msg(PROTO_UPDATE, struct.pack('<Q', note_id)
+                   + note_body(tick, freq, *args, **kwargs))
+
+def bin_clear():
+    return bin_msg(PROTO_CLEAR)
+
+def bin_tempo(tempo_s, tick=None, ramp=False):
+    if tick is None:
+        return bin_msg(PROTO_TEMPO, struct.pack('<f', tempo_s))
+    return bin_msg(PROTO_TEMPO, struct.pack('<fIB3x', tempo_s, tick, ramp))
+
+def bin_remove(tick, freq):
+    return bin_msg(PROTO_REMOVE, struct.pack('<If', tick, freq))
+
+def bin_voices(nvoices):
+    return bin_msg(PROTO_VOICES, struct.pack('<I', nvoices))
+
+def bin_dgram(msgs):
+    return struct.pack('<BBH', PROTO_MAGIC, PROTO_VERSION, len(msgs)) \
+        + b''.join(msgs)
+
+def parse_ids(dgram):
+    '''
+    the note IDs in a reply, text or binary, 0 for notes that weren't added
+    '''
+    if dgram[:1] == bytes([PROTO_MAGIC]):
+        _, _, count = struct.unpack_from('<BBH', dgram)
+        off = 4
+        ids = []
+        for i in range(count):
+            mtype, _, blen = struct.unpack_from('<BBH', dgram, off)
+            if mtype == PROTO_ID:
+                ids.append(struct.unpack_from('<Q', dgram, off + 4)[0])
+            off = off + 4 + blen
+        return ids
+    return [int(l.split()[1]) for l in dgram.decode().splitlines()
+            if l.startswith('id ')]
 
 class sockudp:
     '''
@@ -23,3 +95,44 @@ class sockudp:
             if sent == 0:
                 raise RuntimeError("socket connection broken")
             totalsent = totalsent + sent
+
+    def recvids(self, timeout=1.):
+        '''
+        wait for the reply to a datagram with notes in it
+        '''
+        self.sock.settimeout(timeout)
+        try:
+            return parse_ids(self.sock.recv(65536))
+        finally:
+            self.sock.settimeout(None)
+
+    def sendlines(self, lines, maxlen=1472):
+        '''
+        send messages newline separated, packing as many as fit in each
+        datagram
+        '''
+        buf = ''
+        for line in lines:
+            if buf and (len(buf) + len(line) + 1 > maxlen):
+                self.mysend(buf)
+                buf = ''
+            buf = buf + line + '\n'
+        if buf:
+            self.mysend(buf)
+
+    def sendbin(self, msgs, maxlen=1472):
+        '''
+        send binary messages made with the bin_ functions, packing as many
+        as fit in each datagram
+        '''
+        batch = []
+        size = 4
+        for m in msgs:
+            if batch and (size + len(m) > maxlen):
+                self.mysend(bin_dgram(batch))
+                batch = []
+                size = 4
+            batch.append(m)
+            size = size + len(m)
+        if batch:
+            self.mysend(bin_dgram(batch))
@@ -0,0 +1,134 @@
+/* Checks the fixed point phase kernels against the float ones. With
+ * frequencies whose phase increments are short binary fractions neither
+ * phase ever rounds, so every kernel width must give the same output in
+ * both modes, bit for bit. Also compares how far each mode's phase has
+ * drifted after a long note at an ordinary frequency. Exits non-zero on
+ * failure. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "defs.h"
+#include "types.h"
+#include "synth_bank.h"
+#include "wtset.h"
+
+#define SR 48000
+#define LEN 4096
+#define NVOICES 37
+#define NSAMPS 48000
+#define BLOCK 300
+
+static f64_t out[2][NSAMPS];
+
+/* Renders the same voices in both phase modes */
+static int render(synth_bank_isa_t isa, synth_vc_proc_t *sp)
+{
+    synth_bank_phase_t phase;
+    size_t n;
+    for (phase = synth_bank_phase_FLOAT; phase <= synth_bank_phase_FIXED; phase++) {
+        synth_bank_t b;
+        synth_bank_init_t sbi = SYNTH_BANK_INIT_DEFAULT;
+        sbi.nvoices = NVOICES;
+        sbi.isa = isa;
+        sbi.phase = phase;
+        if (synth_bank_init(&b,&sbi) != err_NONE) {
+            return -1;
+        }
+        for (n = 0; n < NVOICES; n++) {
+            synth_vc_init_t svi = SYNTH_VC_INIT_DEFAULT;
+            /* n/4 + 1/8 table samples per sample in the full table */
+            svi.freq = (f64_t)SR / LEN * (2 * n + 1) / 8.f;
+            svi.s = 0.4;
+            svi.r = 0.3;
+            if (synth_bank_add(&b,sp,&svi,n * 13) != err_NONE) {
+                synth_bank_destroy(&b);
+                return -1;
+            }
+        }
+        _MZ(out[phase],f64_t,NSAMPS);
+        for (n = 0; n < NSAMPS; n += BLOCK) {
+            synth_bank_proc(&b,sp,out[phase] + n,BLOCK);
+        }
+        synth_bank_destroy(&b);
+    }
+    return 0;
+}
+
+/* Phase error in periods of each mode after nsamps samples of freq */
+static void drift(f64_t freq, size_t nsamps, double *err_float, double *err_fixed)
+{
+    static f64_t wt[LEN + 1], buf[SR];
+    synth_vc_proc_t sp = { .sr = SR, .wt = wt, .len = LEN };
+    synth_bank_phase_t phase;
+    for (phase = synth_bank_phase_FLOAT; phase <= synth_bank_phase_FIXED; phase++) {
+        synth_bank_t b;
+        synth_bank_init_t sbi = SYNTH_BANK_INIT_DEFAULT;
+        sbi.nvoices = 1;
+        sbi.isa = synth_bank_isa_SCALAR;
+        sbi.phase = phase;
+        synth_bank_init(&b,&sbi);
+        synth_vc_init_t svi = SYNTH_VC_INIT_DEFAULT;
+        svi.freq = freq;
+        svi.a = 0;
+        svi.d = 0;
+        svi.s = nsamps / (f64_t)SR + 1;
+        synth_bank_add(&b,&sp,&svi,0);
+        size_t done, k;
+        for (done = 0; done < nsamps; done += k) {
+            k = nsamps - done < SR ? nsamps - done : SR;
+            synth_bank_proc(&b,&sp,buf,k);
+        }
+        double exact = (double)svi.freq * nsamps / SR,
+               got = phase == synth_bank_phase_FIXED ?
+                   b.acc[0] / 4294967296. : b.phs[0] / (double)LEN,
+               err = fabs(got - (exact - floor(exact)));
+        if (err > 0.5) {
+            err = 1 - err;
+        }
+        *(phase == synth_bank_phase_FIXED ? err_fixed : err_float) = err;
+        synth_bank_destroy(&b);
+    }
+}
+
+int main(void)
+{
+    static f64_t wt[LEN + 1];
+    size_t n;
+    int fail = 0;
+    for (n = 0; n < LEN; n++) {
+        wt[n] = sin(2. * M_PI * n / LEN) + 0.3 * cos(2. * M_PI * 5 * n / LEN);
+    }
+    wt[LEN] = wt[0];
+    wtset_t ws;
+    if (wtset_init(&ws,SR,LEN,10,NULL) != err_NONE) {
+        return 1;
+    }
+    synth_vc_proc_t single = { .sr = SR, .wt = wt, .len = LEN },
+                    set = { .sr = SR, .wt = ws.wt, .len = LEN, .set = &ws };
+    synth_vc_proc_t *sps[] = { &single, &set };
+    const char *names[] = { "single table", "wavetable set" };
+    synth_bank_isa_t isa;
+    for (isa = synth_bank_isa_SCALAR; isa <= synth_bank_isa_AVX512; isa++) {
+        size_t s;
+        for (s = 0; s < 2; s++) {
+            if (render(isa,sps[s]) != 0) {
+                /* not supported by this CPU */
+                continue;
+            }
+            int same = memcmp(out[0],out[1],sizeof(out[0])) == 0;
+            printf("%-8s %-14s fixed == float: %s\n",
+                   synth_bank_isa_name(isa),names[s],same ? "yes" : "NO");
+            fail |= !same;
+        }
+    }
+    double err_float = 0, err_fixed = 0;
+    drift(440,(size_t)SR * 600,&err_float,&err_fixed);
+    printf("phase error after 10 minutes at 440 Hz, in periods: "
+           "float %.3g, fixed %.3g\n",err_float,err_fixed);
+    fail |= !(err_fixed < err_float);
+    wtset_destroy(&ws);
+    printf("%s\n",fail ? "FAIL" : "ok");
+    return fail;
+}
@@ -0,0 +1,156 @@
+/* Fork-join worker pool */
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#include "workers.h"
+#include <sched.h>
+#include <limits.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax()
+#endif
+
+static void futex_wait(_Atomic uint32_t *p, uint32_t val)
+{
+    syscall(SYS_futex,p,FUTEX_WAIT_PRIVATE,val,NULL,NULL,0);
+}
+
+static void futex_wake(_Atomic uint32_t *p)
+{
+    syscall(SYS_futex,p,FUTEX_WAKE_PRIVATE,INT_MAX,NULL,NULL,0);
+}
+
+/* Returns once *p is no longer val, spinning first then sleeping. nsleep
+ * counts sleepers so whoever changes *p knows whether to wake them. */
+static void wait_change(workers_t *w, _Atomic uint32_t *p, uint32_t val,
+                        _Atomic uint32_t *nsleep)
+{
+    size_t n;
+    for (n = 0; n < w->spin; n++) {
+        if (atomic_load_explicit(p,memory_order_acquire) != val) {
+            return;
+        }
+        cpu_relax();
+    }
+    while (atomic_load(p) == val) {
+        atomic_fetch_add(nsleep,1);
+        /* the kernel checks *p again so a change after the load above is
+         * not missed */
+        futex_wait(p,val);
+        atomic_fetch_sub(nsleep,1);
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    workers_arg_t *wa = arg;
+    workers_t *w = wa->w;
+    uint32_t seen = 0;
+    for (;;) {
+        wait_change(w,&w->gen,seen,&w->_nsleep);
+        seen = atomic_load_explicit(&w->gen,memory_order_acquire);
+        if (w->_quit) {
+            break;
+        }
+        w->_fn(w->_arg,wa->id);
+        if (atomic_fetch_sub(&w->pending,1) == 1) {
+            if (atomic_load(&w->_caller_sleeps)) {
+                futex_wake(&w->pending);
+            }
+        }
+    }
+    return NULL;
+}
+
+err_t workers_init(workers_t *w, workers_init_t *wi)
+{
+    size_t n;
+    _MZ(w,workers_t,1);
+    if ((wi->nthreads == 0) || (wi->nthreads > WORKERS_MAX)) {
+        return err_EINVAL;
+    }
+    w->nthreads = wi->nthreads;
+    w->spin = wi->spin;
+    atomic_init(&w->gen,0);
+    atomic_init(&w->_nsleep,0);
+    atomic_init(&w->pending,0);
+    atomic_init(&w->_caller_sleeps,0);
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    for (n = 1; n < w->nthreads; n++) {
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        w->_args[n] = (workers_arg_t) { .w = w, .id = n };
+        int rt = 0;
+        if (wi->rt_prio > 0) {
+            struct sched_param sp = { .sched_priority = wi->rt_prio };
+            pthread_attr_setinheritsched(&attr,PTHREAD_EXPLICIT_SCHED);
+            pthread_attr_setschedpolicy(&attr,SCHED_FIFO);
+            pthread_attr_setschedparam(&attr,&sp);
+            rt = pthread_create(&w->_threads[n],&attr,worker_main,
+                                &w->_args[n]) == 0;
+        }
+        if (!rt) {
+            /* not allowed realtime scheduling, run as a normal thread */
+            if (wi->rt_prio > 0) {
+                w->n_no_rt++;
+            }
+            pthread_attr_destroy(&attr);
+            pthread_attr_init(&attr);
+            if (pthread_create(&w->_threads[n],&attr,worker_main,
+                               &w->_args[n]) != 0) {
+                pthread_attr_destroy(&attr);
+                workers_destroy(w);
+                return err_MEM;
+            }
+        }
+        pthread_attr_destroy(&attr);
+        w->_nstarted = n;
+        if (wi->pin) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(n % (ncpu > 0 ? ncpu : 1),&set);
+            if (pthread_setaffinity_np(w->_threads[n],sizeof(set),&set) != 0) {
+                w->n_no_pin++;
+            }
+        }
+    }
+    return err_NONE;
+}
+
+void workers_destroy(workers_t *w)
+{
+    size_t n;
+    w->_quit = 1;
+    atomic_fetch_add(&w->gen,1);
+    futex_wake(&w->gen);
+    for (n = 1; n <= w->_nstarted; n++) {
+        pthread_join(w->_threads[n],NULL);
+    }
+    _MZ(w,workers_t,1);
+}
+
+/* Calls fn(arg,n) on every worker n, the caller being worker 0, and returns
+ * when all have returned. Only called by one thread at a time. */
+void workers_run(workers_t *w, workers_fn_t fn, void *arg)
+{
+    if (w->nthreads > 1) {
+        w->_fn = fn;
+        w->_arg = arg;
+        atomic_store(&w->pending,w->nthreads - 1);
+        atomic_fetch_add(&w->gen,1);
+        if (atomic_load(&w->_nsleep)) {
+            futex_wake(&w->gen);
+        }
+    }
+    fn(arg,0);
+    if (w->nthreads > 1) {
+        uint32_t left;
+        while ((left = atomic_load_explicit(&w->pending,memory_order_acquire))) {
+            wait_change(w,&w->pending,left,&w->_caller_sleeps);
+        }
+    }
+}
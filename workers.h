@@ -0,0 +1,69 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+
+/* Fork-join pool for splitting a block's work over several cores. The
+ * calling thread is worker 0 and runs its share too. Workers wait for a
+ * job by spinning for a while, which keeps wakeups cheap when blocks are
+ * short, and then sleep on a futex so that idle workers don't use a core.
+ * The caller waits for them the same way. Linux only. */
+
+#define WORKERS_MAX 64
+#define WORKERS_CACHE_LINE 64
+
+typedef void (*workers_fn_t)(void *arg, size_t worker);
+
+typedef struct workers_init_t {
+    size_t nthreads;  /* including the caller */
+    size_t spin;      /* polls before sleeping */
+    int rt_prio;      /* SCHED_FIFO priority of the workers, 0 to not ask */
+    int pin;          /* pin worker n to CPU n */
+} workers_init_t;
+
+#define WORKERS_INIT_DEFAULT (workers_init_t) { \
+    .nthreads = 1, \
+    .spin = 4000, \
+    .rt_prio = 0, \
+    .pin = 1 \
+}
+
+struct workers_t;
+
+typedef struct workers_arg_t {
+    struct workers_t *w;
+    size_t id;
+} workers_arg_t;
+
+/* The threads keep a pointer to this so it must not move once started */
+typedef struct workers_t {
+    size_t nthreads;
+    size_t spin;
+    workers_fn_t _fn;
+    void *_arg;
+    int _quit;
+    /* bumped to start a job, futex words so 32 bits */
+    _Atomic uint32_t gen __attribute__((aligned(WORKERS_CACHE_LINE)));
+    _Atomic uint32_t _nsleep;
+    /* workers still running the current job */
+    _Atomic uint32_t pending __attribute__((aligned(WORKERS_CACHE_LINE)));
+    _Atomic uint32_t _caller_sleeps;
+    pthread_t _threads[WORKERS_MAX];
+    workers_arg_t _args[WORKERS_MAX];
+    size_t _nstarted;
+    /* workers that could not get realtime priority or be pinned */
+    size_t n_no_rt;
+    size_t n_no_pin;
+} workers_t;
+
+err_t workers_init(workers_t *w, workers_init_t *wi);
+void workers_destroy(workers_t *w);
+void workers_run(workers_t *w, workers_fn_t fn, void *arg);
+
+#endif /* WORKERS_H */
@@ -0,0 +1,111 @@
+/* Band-limited wavetable set */
+#include "wtset.h"
+#include <math.h>
+
+/* Fills len samples with the first nharm terms of the harmonic series */
+static void fill_level(f64_t *wt, size_t len, size_t nharm)
+{
+    size_t n, m;
+    _MZ(wt,f64_t,len);
+    for (n = 1; n <= nharm; n++) {
+        f64_t phs_inc = 2. * M_PI * (f64_t)n / len,
+              phs = 0;
+        for (m = 0; m < len; m++) {
+            wt[m] += cos(phs) / (f64_t)(n*n);
+            phs += phs_inc;
+        }
+    }
+}
+
+/* Lays out the levels. Level 0 has len samples and up to nharm
+ * harmonics, higher levels fewer of each. */
+static err_t plan_levels(wtset_t *ws, f64_t sr, size_t len, size_t nharm)
+{
+    _MZ(ws,wtset_t,1);
+    if ((sr <= 0) || (len < 2) || (nharm == 0)) {
+        return err_EINVAL;
+    }
+    f64_t nyq = sr / 2, top;
+    size_t k, size = 0;
+    ws->base_freq = WTSET_BASE_FREQ;
+    for (k = 0; k < WTSET_MAX_LEVELS; k++) {
+        top = ws->base_freq * (f64_t)(2 << k);
+        size_t nh = (size_t)(nyq / top),
+               l = (len >> k) ? (len >> k) : 1;
+        if (nh > nharm) {
+            nh = nharm;
+        }
+        if (nh == 0) {
+            nh = 1; /* the fundamental aliases anyway */
+        }
+        /* powers of 2 stay powers of 2 for the fixed point kernels */
+        while (l < WTSET_OVERSAMPLE * nh) {
+            l *= 2;
+        }
+        if (l < WTSET_MIN_LEN) {
+            l = WTSET_MIN_LEN;
+        }
+        if ((k == 0) || (l > len)) {
+            l = len;
+        }
+        ws->lvl[k] = (wtset_lvl_t) { .off = size, .len = l, .nharm = nh };
+        /* keep every level's start on a cache line */
+        size += (l + 1 + WTSET_ALIGN / sizeof(f64_t) - 1)
+            / (WTSET_ALIGN / sizeof(f64_t)) * (WTSET_ALIGN / sizeof(f64_t));
+        ws->nlevels = k + 1;
+        if (top >= nyq) {
+            break;
+        }
+    }
+    ws->size = size;
+    return err_NONE;
+}
+
+/* 0 if there can be no such set */
+size_t wtset_mem_size(f64_t sr, size_t len, size_t nharm)
+{
+    wtset_t ws;
+    if (plan_levels(&ws,sr,len,nharm) != err_NONE) {
+        return 0;
+    }
+    return arena_size(ws.size * sizeof(f64_t));
+}
+
+/* Takes wtset_mem_size(sr,len,nharm) bytes from arena */
+err_t wtset_init(wtset_t *ws, f64_t sr, size_t len, size_t nharm, arena_t *arena)
+{
+    err_t err;
+    size_t k;
+    if ((err = plan_levels(ws,sr,len,nharm)) != err_NONE) {
+        return err;
+    }
+    ws->_arena = arena;
+    ws->wt = arena_alloc(arena,ws->size * sizeof(f64_t));
+    if (!ws->wt) {
+        return err_MEM;
+    }
+    for (k = 0; k < ws->nlevels; k++) {
+        f64_t *wt = ws->wt + ws->lvl[k].off;
+        fill_level(wt,ws->lvl[k].len,ws->lvl[k].nharm);
+        wt[ws->lvl[k].len] = wt[0];
+    }
+    return err_NONE;
+}
+
+void wtset_destroy(wtset_t *ws)
+{
+    arena_free(ws->_arena,ws->wt);
+    _MZ(ws,wtset_t,1);
+}
+
+/* Returns the level to play freq from */
+size_t wtset_level(const wtset_t *ws, f64_t freq)
+{
+    int ex;
+    if (!(freq >= ws->base_freq * 2)) {
+        return 0;
+    }
+    /* freq / base_freq = m * 2^ex with m in [0.5, 1) */
+    frexpf(freq / ws->base_freq,&ex);
+    return (size_t)(ex - 1) < ws->nlevels ? (size_t)(ex - 1) : ws->nlevels - 1;
+}
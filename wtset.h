@@ -0,0 +1,44 @@
+#ifndef WTSET_H
+#define WTSET_H
+
+#include "err.h"
+#include "types.h"
+#include "defs.h"
+#include "arena.h"
+
+/* Band-limited wavetables, one level per octave. Level k is played by
+ * voices with frequencies in [base_freq * 2^k, base_freq * 2^(k+1)) (level
+ * 0 also takes anything lower) and only has the harmonics that stay below
+ * Nyquist at the top of that range. As the number of harmonics falls the
+ * tables get shorter, so high voices read far less memory. All levels are
+ * in one allocation, each followed by a copy of its first sample so
+ * interpolation never has to wrap. */
+
+#define WTSET_MAX_LEVELS 16
+#define WTSET_BASE_FREQ 27.5 /* A0 */
+#define WTSET_MIN_LEN 64
+/* samples per period of the highest harmonic, at least */
+#define WTSET_OVERSAMPLE 8
+#define WTSET_ALIGN 64
+
+typedef struct wtset_lvl_t {
+    size_t off;   /* of the first sample in wt */
+    size_t len;   /* not counting the guard sample */
+    size_t nharm;
+} wtset_lvl_t;
+
+typedef struct wtset_t {
+    f64_t *wt;
+    size_t nlevels;
+    f64_t base_freq;
+    size_t size; /* samples in wt */
+    wtset_lvl_t lvl[WTSET_MAX_LEVELS];
+    arena_t *_arena;
+} wtset_t;
+
+err_t wtset_init(wtset_t *ws, f64_t sr, size_t len, size_t nharm, arena_t *arena);
+size_t wtset_mem_size(f64_t sr, size_t len, size_t nharm);
+void wtset_destroy(wtset_t *ws);
+size_t wtset_level(const wtset_t *ws, f64_t freq);
+
+#endif /* WTSET_H */